@@ -0,0 +1,47 @@
+#!/bin/bash
+# Build the int8 MobileFaceNet embedded by the enclave when
+# EMBEDDING_MODEL_INT8 is enabled in src/enclave/secure/embedding.cpp.
+#
+# The calibration table is computed from a directory of aligned 112x112 face
+# crops, then ncnn2int8 quantizes the (optimized) fp32 model with it and
+# ncnn2mem writes mobilefacenet_int8.mem.h/mobilefacenet_int8.id.h.
+
+if [ $# -ne 4 ]; then
+        echo "Usage: $0 <ncnn tools dir> <fp32 param> <fp32 bin> <face crops dir>"
+        exit 1
+fi
+
+TOOLS=$(realpath $1)
+PARAM=$(realpath $2)
+BIN=$(realpath $3)
+FACES=$(realpath $4)
+HEADER_DIR=$(realpath $(dirname $0)/../src/enclave/secure)
+
+for tool in ncnn2table ncnn2int8 ncnn2mem; do
+        if [ ! -x $TOOLS/$tool ]; then
+                echo "$tool not found in $TOOLS"
+                exit 1
+        fi
+done
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+find $FACES -type f \( -iname '*.jpg' -o -iname '*.png' \) | sort > $WORK/imagelist.txt
+if [ ! -s $WORK/imagelist.txt ]; then
+        echo "No face crops in $FACES"
+        exit 1
+fi
+echo "Calibrating on $(wc -l < $WORK/imagelist.txt) faces"
+
+# the model takes raw RGB pixels, its input scaling is part of the graph
+$TOOLS/ncnn2table $PARAM $BIN $WORK/imagelist.txt $WORK/mobilefacenet.table \
+        mean=[0,0,0] norm=[1,1,1] shape=[112,112,3] pixel=RGB thread=8 method=kl || exit 1
+
+cd $WORK
+$TOOLS/ncnn2int8 $PARAM $BIN mobilefacenet_int8.param mobilefacenet_int8.bin \
+        mobilefacenet.table || exit 1
+$TOOLS/ncnn2mem mobilefacenet_int8.param mobilefacenet_int8.bin \
+        $HEADER_DIR/mobilefacenet_int8.id.h $HEADER_DIR/mobilefacenet_int8.mem.h || exit 1
+
+echo "Wrote $HEADER_DIR/mobilefacenet_int8.mem.h"
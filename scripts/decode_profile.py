@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Print the enclave traces written to profile.bin when ENCLAVE_PROFILE is on.
+
+Each ecall appends one trace: a 16 byte header (magic "PRF1", clock, count,
+dropped) followed by count 16 byte records (event u16, aux u16, id u32,
+cycles u64). See src/enclave/secure/profiler.h.
+
+usage: decode_profile.py [profile.bin] [--ids mobilefacenet.id.h] [--top N]
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MAGIC = 0x31465250
+HEADER = struct.Struct("<IIII")
+RECORD = struct.Struct("<HHIQ")
+
+CLOCKS = ["none", "rdcycle", "rdtsc"]
+REQUESTS = ["record", "record-batch", "verify", "train-pq"]
+EVENTS = ["request", "load_model", "layer", "read_file", "list_records",
+          "write_file", "write_files", "seal", "unseal", "encrypt", "decrypt",
+          "read_records"]
+EV_LAYER = 2
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_IDS = os.path.join(HERE, "..", "src", "enclave", "secure", "mobilefacenet.id.h")
+DEFAULT_TYPES = os.path.join(HERE, "..", "src", "enclave", "enclave_include",
+                             "ncnn.rv", "layer_type_enum.h")
+
+
+def read_names(path, pattern):
+    names = {}
+    if os.path.exists(path):
+        with open(path) as f:
+            for m in re.finditer(pattern, f.read()):
+                names.setdefault(int(m.group(2)), m.group(1))
+    return names
+
+
+def traces(data):
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, clock, count, dropped = HEADER.unpack_from(data, pos)
+        if magic != MAGIC:
+            raise ValueError("bad trace magic at offset %d" % pos)
+        pos += HEADER.size
+        records = [RECORD.unpack_from(data, pos + i * RECORD.size) for i in range(count)]
+        pos += count * RECORD.size
+        yield clock, dropped, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("trace", nargs="?", default="profile.bin")
+    parser.add_argument("--ids", default=DEFAULT_IDS, help="ncnn2mem id header for layer names")
+    parser.add_argument("--types", default=DEFAULT_TYPES, help="ncnn layer_type_enum.h")
+    parser.add_argument("--top", type=int, default=15, help="slowest layers to list")
+    args = parser.parse_args()
+
+    layer_names = read_names(args.ids, r"LAYER_(\w+)\s*=\s*(\d+)")
+    type_names = read_names(args.types, r"(\w+)\s*=\s*(\d+)")
+
+    with open(args.trace, "rb") as f:
+        data = f.read()
+
+    for n, (clock, dropped, records) in enumerate(traces(data)):
+        total = [r for r in records if r[0] == 0]
+        request = REQUESTS[total[0][2]] if total else "?"
+        print("#%d %s, %s cycles%s" % (n, request, CLOCKS[clock] if clock < len(CLOCKS) else clock,
+                                       ", %d records dropped" % dropped if dropped else ""))
+
+        sums = {}
+        for event, _, _, cycles in records:
+            calls, acc = sums.get(event, (0, 0))
+            sums[event] = (calls + 1, acc + cycles)
+        for event in sorted(sums):
+            calls, acc = sums[event]
+            name = EVENTS[event] if event < len(EVENTS) else str(event)
+            print("  %-14s %6d calls %14d cycles" % (name, calls, acc))
+
+        layers = {}
+        for event, aux, id_, cycles in records:
+            if event == EV_LAYER:
+                acc = layers.get(id_, (aux, 0))[1]
+                layers[id_] = (aux, acc + cycles)
+        by_type = {}
+        for aux, acc in layers.values():
+            by_type[aux] = by_type.get(aux, 0) + acc
+        if by_type:
+            print("  by layer type:")
+            for aux, acc in sorted(by_type.items(), key=lambda x: -x[1]):
+                print("    %-22s %14d" % (type_names.get(aux, str(aux)), acc))
+            print("  slowest layers:")
+            for id_, (aux, acc) in sorted(layers.items(), key=lambda x: -x[1][1])[:args.top]:
+                print("    %4d %-28s %-22s %14d" % (id_, layer_names.get(id_, ""),
+                                                    type_names.get(aux, str(aux)), acc))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,456 @@
+#!/usr/bin/env python3
+"""Offline graph optimizer for the ncnn MobileFaceNet model embedded in the enclave.
+
+Rewrites an fp32 ncnn param/bin pair so that fewer layers run per inference:
+
+  * scalar BinaryOp input scaling right after Input ((x - 127.5) * 0.0078125)
+    is folded into the weights of the first convolution, padding uses the raw
+    pixel value that maps to zero
+  * BatchNorm/Scale after Convolution, ConvolutionDepthWise or InnerProduct is
+    folded into their weights and bias
+  * ReLU and single-slope PReLU after those layers become the fused activation
+    of the layer. per-channel PReLU is kept, stock ncnn has no fused form of it
+  * Split layers with a single used output and Dropout/Noop are removed.
+    Splits feeding several consumers are kept, ncnn tracks one consumer per
+    blob and needs them for residual connections
+
+The result can be turned into the headers the enclave compiles in with
+ncnn2mem (--ncnn2mem), which writes mobilefacenet.mem.h and mobilefacenet.id.h.
+
+usage: optimize_model.py in.param in.bin out.param out.bin [--ncnn2mem PATH]
+"""
+
+import argparse
+import math
+import os
+import shutil
+import struct
+import subprocess
+import sys
+from array import array
+
+MAGIC = 7767517
+
+TAG_FP16 = 0x01306B47
+TAG_INT8 = 0x000D4B38
+TAG_RAW_SCALED = 0x0002C056
+
+# layers without any weight in the model bin
+WEIGHTLESS = {
+    "Input", "Split", "BinaryOp", "Flatten", "Pooling", "ReLU", "Dropout",
+    "Eltwise", "Concat", "Reshape", "Softmax", "Noop", "Sigmoid", "Permute",
+    "Crop", "Slice", "Interp", "Padding", "Clip", "TanH", "HardSwish",
+}
+
+FOLD_TARGETS = ("Convolution", "ConvolutionDepthWise", "InnerProduct")
+
+# ncnn fused activation types
+ACT_RELU = 1
+ACT_LEAKYRELU = 2
+
+
+class ModelError(Exception):
+    pass
+
+
+class Layer:
+    def __init__(self, type_, name, bottoms, tops, params):
+        self.type = type_
+        self.name = name
+        self.bottoms = bottoms
+        self.tops = tops
+        # ordered list of [key, value string], arrays keep "n,v1,v2" form
+        self.params = params
+        # list of (tagged, array('f'))
+        self.weights = []
+
+    def get(self, key, default=None):
+        for k, v in self.params:
+            if k == key:
+                return v
+        return default
+
+    def get_int(self, key, default=0):
+        v = self.get(key)
+        return default if v is None else int(v)
+
+    def get_float(self, key, default=0.0):
+        v = self.get(key)
+        return default if v is None else float(v)
+
+    def set(self, key, value):
+        for p in self.params:
+            if p[0] == key:
+                p[1] = value
+                return
+        self.params.append([key, value])
+
+    def set_array(self, id_, values):
+        self.set(str(-23300 - id_),
+                 ",".join([str(len(values))] + ["%.9g" % v for v in values]))
+
+
+def read_param(path):
+    with open(path) as f:
+        tokens = f.read().split("\n")
+    lines = [l for l in tokens if l.strip()]
+    if int(lines[0]) != MAGIC:
+        raise ModelError("%s is not an ncnn text param" % path)
+
+    layers = []
+    for line in lines[2:]:
+        parts = line.split()
+        type_, name = parts[0], parts[1]
+        nb, nt = int(parts[2]), int(parts[3])
+        bottoms = parts[4:4 + nb]
+        tops = parts[4 + nb:4 + nb + nt]
+        params = [p.split("=", 1) for p in parts[4 + nb + nt:]]
+        layers.append(Layer(type_, name, bottoms, tops, params))
+    return layers
+
+
+class BinReader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def raw(self, n):
+        a = array("f")
+        a.frombytes(self.data[self.pos:self.pos + 4 * n])
+        if len(a) != n:
+            raise ModelError("model bin is truncated")
+        self.pos += 4 * n
+        return a
+
+    def tagged(self, n):
+        (tag,) = struct.unpack_from("<I", self.data, self.pos)
+        self.pos += 4
+        if tag == TAG_FP16:
+            size = (n * 2 + 3) // 4 * 4
+            halves = struct.unpack_from("<%de" % n, self.data, self.pos)
+            self.pos += size
+            return array("f", halves)
+        if tag == TAG_INT8:
+            raise ModelError("int8 weights are not supported, optimize the fp32 model")
+        if tag == TAG_RAW_SCALED or tag == 0:
+            return self.raw(n)
+        if tag & 0xff:
+            # 256 entry value table followed by indices
+            table = self.raw(256)
+            size = (n + 3) // 4 * 4
+            idx = self.data[self.pos:self.pos + n]
+            self.pos += size
+            return array("f", (table[i] for i in idx))
+        return self.raw(n)
+
+
+def read_bin(layers, path):
+    with open(path, "rb") as f:
+        r = BinReader(f.read())
+
+    for layer in layers:
+        t = layer.type
+        if t in ("Convolution", "ConvolutionDepthWise", "InnerProduct"):
+            if layer.get_int("8"):
+                raise ModelError("%s is int8 quantized, optimize the fp32 model" % layer.name)
+            num_output = layer.get_int("0")
+            size_key = "2" if t == "InnerProduct" else "6"
+            bias_key = "1" if t == "InnerProduct" else "5"
+            layer.weights.append((True, r.tagged(layer.get_int(size_key))))
+            if layer.get_int(bias_key):
+                layer.weights.append((False, r.raw(num_output)))
+        elif t == "PReLU":
+            layer.weights.append((False, r.raw(layer.get_int("0"))))
+        elif t == "BatchNorm":
+            channels = layer.get_int("0")
+            for _ in range(4):
+                layer.weights.append((False, r.raw(channels)))
+        elif t == "Scale":
+            size = layer.get_int("0")
+            if size != -233:
+                layer.weights.append((False, r.raw(size)))
+                if layer.get_int("1"):
+                    layer.weights.append((False, r.raw(size)))
+        elif t not in WEIGHTLESS:
+            raise ModelError("don't know the weights of layer type %s" % t)
+
+    if r.pos != len(r.data):
+        raise ModelError("%d trailing bytes in the model bin" % (len(r.data) - r.pos))
+
+
+def write_param(layers, path):
+    blobs = set()
+    for layer in layers:
+        blobs.update(layer.tops)
+    with open(path, "w") as f:
+        f.write("%d\n%d %d\n" % (MAGIC, len(layers), len(blobs)))
+        for layer in layers:
+            fields = ["%-16s" % layer.type, "%-24s" % layer.name,
+                      str(len(layer.bottoms)), str(len(layer.tops))]
+            fields += layer.bottoms + layer.tops
+            fields += ["%s=%s" % (k, v) for k, v in layer.params]
+            f.write(" ".join(fields) + "\n")
+
+
+def write_bin(layers, path):
+    with open(path, "wb") as f:
+        for layer in layers:
+            for tagged, data in layer.weights:
+                if tagged:
+                    f.write(struct.pack("<I", 0))
+                f.write(data.tobytes())
+
+
+def consumers(layers):
+    users = {}
+    for i, layer in enumerate(layers):
+        for b in layer.bottoms:
+            users.setdefault(b, []).append(i)
+    return users
+
+
+def weight_layout(layer):
+    """(num_output, inputs per output) of a fold target"""
+    num_output = layer.get_int("0")
+    w = layer.weights[0][1]
+    return num_output, len(w) // num_output
+
+
+def bias_of(layer):
+    """bias array of a fold target, created as zeros if missing"""
+    t = layer.type
+    bias_key = "1" if t == "InnerProduct" else "5"
+    if not layer.get_int(bias_key):
+        layer.set(bias_key, "1")
+        layer.weights.append((False, array("f", [0.0] * layer.get_int("0"))))
+    return layer.weights[1][1]
+
+
+def fold_input_scaling(layers):
+    """fold (x op s) scalar BinaryOps after Input into the first convolution"""
+    users = consumers(layers)
+    folded = 0
+    for inp in [l for l in layers if l.type == "Input"]:
+        src = inp.tops[0]
+        chain = []
+        scale, shift = 1.0, 0.0
+        blob = src
+        while True:
+            u = users.get(blob, [])
+            if len(u) != 1:
+                break
+            layer = layers[u[0]]
+            if layer.type != "BinaryOp" or not layer.get_int("1"):
+                break
+            op, b = layer.get_int("0"), layer.get_float("2")
+            if op == 0:
+                shift += b
+            elif op == 1:
+                shift -= b
+            elif op == 2:
+                scale, shift = scale * b, shift * b
+            elif op == 3:
+                scale, shift = scale / b, shift / b
+            else:
+                break
+            chain.append(layer)
+            blob = layer.tops[0]
+
+        u = users.get(blob, [])
+        if not chain or len(u) != 1:
+            continue
+        conv = layers[u[0]]
+        if conv.type not in ("Convolution", "ConvolutionDepthWise") or scale == 0.0:
+            continue
+        if conv.get_float("18") != 0.0:
+            continue
+
+        # y = W (s x + t) + b = (s W) x + (b + t sum(W)), pad with the raw
+        # value that the scaling maps to zero
+        num_output, per_output = weight_layout(conv)
+        w = conv.weights[0][1]
+        bias = bias_of(conv)
+        for o in range(num_output):
+            row = range(o * per_output, (o + 1) * per_output)
+            bias[o] += shift * sum(w[i] for i in row)
+            for i in row:
+                w[i] *= scale
+        if any(conv.get_int(k) for k in ("4", "14", "15", "16")):
+            conv.set("18", "%.9g" % (-shift / scale))
+
+        conv.bottoms = [src]
+        for layer in chain:
+            layers.remove(layer)
+        folded += len(chain)
+    return folded
+
+
+def fold_batchnorm(layers):
+    """fold BatchNorm and Scale into the preceding conv/innerproduct"""
+    folded = 0
+    changed = True
+    while changed:
+        changed = False
+        users = consumers(layers)
+        producer = {t: l for l in layers for t in l.tops}
+        for bn in layers:
+            if bn.type not in ("BatchNorm", "Scale") or len(bn.bottoms) != 1:
+                continue
+            if bn.type == "Scale" and not bn.weights:
+                continue
+            prev = producer.get(bn.bottoms[0])
+            if prev is None or prev.type not in FOLD_TARGETS:
+                continue
+            if prev.get_int("9") or len(users[bn.bottoms[0]]) != 1:
+                continue
+
+            num_output, per_output = weight_layout(prev)
+            if bn.type == "BatchNorm":
+                slope, mean, var, beta = (w for _, w in bn.weights)
+                eps = bn.get_float("1")
+                a = [slope[c] / math.sqrt(var[c] + eps) for c in range(num_output)]
+                b = [beta[c] - a[c] * mean[c] for c in range(num_output)]
+            else:
+                a = list(bn.weights[0][1])
+                b = list(bn.weights[1][1]) if len(bn.weights) > 1 else [0.0] * num_output
+            if len(a) != num_output:
+                continue
+
+            w = prev.weights[0][1]
+            bias = bias_of(prev)
+            for o in range(num_output):
+                for i in range(o * per_output, (o + 1) * per_output):
+                    w[i] *= a[o]
+                bias[o] = bias[o] * a[o] + b[o]
+
+            prev.tops = bn.tops
+            layers.remove(bn)
+            folded += 1
+            changed = True
+            break
+    return folded
+
+
+def fuse_activation(layers):
+    """turn ReLU and single-slope PReLU into fused activations"""
+    fused = 0
+    users = consumers(layers)
+    producer = {t: l for l in layers for t in l.tops}
+    for act in list(layers):
+        if act.type == "ReLU":
+            slope = act.get_float("0")
+        elif act.type == "PReLU" and act.get_int("0") == 1:
+            slope = act.weights[0][1][0]
+        else:
+            continue
+        prev = producer.get(act.bottoms[0])
+        if prev is None or prev.type not in FOLD_TARGETS or prev.get_int("9"):
+            continue
+        if len(users[act.bottoms[0]]) != 1:
+            continue
+
+        if slope == 0.0:
+            prev.set("9", str(ACT_RELU))
+        else:
+            prev.set("9", str(ACT_LEAKYRELU))
+            prev.set_array(10, [slope])
+        prev.tops = act.tops
+        layers.remove(act)
+        fused += 1
+        producer = {t: l for l in layers for t in l.tops}
+    return fused
+
+
+def remove_trivial(layers):
+    """drop Dropout/Noop and Splits with a single used output"""
+    removed = 0
+    changed = True
+    while changed:
+        changed = False
+        users = consumers(layers)
+        for layer in layers:
+            if layer.type in ("Dropout", "Noop") and len(layer.bottoms) == 1:
+                pass
+            elif layer.type == "Split":
+                used = [t for t in layer.tops if t in users]
+                if len(used) > 1:
+                    if len(used) != len(layer.tops):
+                        layer.tops = used
+                        changed = True
+                        break
+                    continue
+            else:
+                continue
+
+            src = layer.bottoms[0]
+            for t in layer.tops:
+                for i in users.get(t, []):
+                    layers[i].bottoms = [src if b == t else b for b in layers[i].bottoms]
+            layers.remove(layer)
+            removed += 1
+            changed = True
+            break
+    return removed
+
+
+def count(layers):
+    counts = {}
+    for layer in layers:
+        counts[layer.type] = counts.get(layer.type, 0) + 1
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("in_param")
+    parser.add_argument("in_bin")
+    parser.add_argument("out_param")
+    parser.add_argument("out_bin")
+    parser.add_argument("--ncnn2mem", help="ncnn2mem binary, writes the enclave headers")
+    parser.add_argument("--header-dir", default=os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), "..", "src", "enclave", "secure"))
+    args = parser.parse_args()
+
+    try:
+        layers = read_param(args.in_param)
+        read_bin(layers, args.in_bin)
+        before = count(layers)
+
+        stats = [
+            ("input scaling ops folded", fold_input_scaling(layers)),
+            ("batchnorm/scale folded", fold_batchnorm(layers)),
+            ("activations fused", fuse_activation(layers)),
+            ("trivial layers removed", remove_trivial(layers)),
+        ]
+
+        write_param(layers, args.out_param)
+        write_bin(layers, args.out_bin)
+    except ModelError as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+
+    after = count(layers)
+    for what, n in stats:
+        print("%-26s %d" % (what, n))
+    for t in sorted(set(before) | set(after)):
+        print("%-26s %3d -> %3d" % (t, before.get(t, 0), after.get(t, 0)))
+    print("%-26s %3d -> %3d" % ("layers", sum(before.values()), len(layers)))
+
+    if args.ncnn2mem:
+        # ncnn2mem names the arrays after the file names
+        workdir = os.path.dirname(os.path.abspath(args.out_param))
+        param = os.path.join(workdir, "mobilefacenet.param")
+        model = os.path.join(workdir, "mobilefacenet.bin")
+        if os.path.abspath(args.out_param) != param:
+            shutil.copyfile(args.out_param, param)
+        if os.path.abspath(args.out_bin) != model:
+            shutil.copyfile(args.out_bin, model)
+        subprocess.check_call([args.ncnn2mem, "mobilefacenet.param", "mobilefacenet.bin",
+                               os.path.join(os.path.abspath(args.header_dir), "mobilefacenet.id.h"),
+                               os.path.join(os.path.abspath(args.header_dir), "mobilefacenet.mem.h")],
+                              cwd=workdir)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
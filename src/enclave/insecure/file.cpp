@@ -8,6 +8,7 @@ extern "C" {
 }
 #endif
 #include "string.h"
+#include "../secure/profiler.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -21,6 +22,7 @@ extern "C" {
 
 extern "C" int write_file(char* in_filename, int in_filename_len, char* in_content, int in_content_len) {
   int retval;
+  PROFILE_SCOPE(PROF_WRITE_FILE, in_content_len);
 
   cc_enclave_result_t __Z_res = __insecure_write_file_impl(&retval , in_filename, in_filename_len, in_content, in_content_len);
   if (__Z_res != CC_SUCCESS) {
@@ -30,10 +32,11 @@ extern "C" int write_file(char* in_filename, int in_filename_len, char* in_conte
 
   return retval;
 }
-extern "C" int get_emb_list(char* out_list) {
+extern "C" int list_records(int cursor, char* out_ids, int out_ids_len) {
   int retval;
+  PROFILE_SCOPE(PROF_LIST_RECORDS, out_ids_len);
 
-  cc_enclave_result_t __Z_res = __insecure_get_emb_list_impl(&retval , out_list);
+  cc_enclave_result_t __Z_res = __insecure_list_records_impl(&retval , cursor, out_ids, out_ids_len);
   if (__Z_res != CC_SUCCESS) {
     printf("Ecall enclave error\n");
     exit(-1);
@@ -43,6 +46,7 @@ extern "C" int get_emb_list(char* out_list) {
 }
 extern "C" int read_file(char* in_filename, int in_filename_len, char* out_content, int out_content_len) {
   int retval;
+  PROFILE_SCOPE(PROF_READ_FILE, out_content_len);
 
   cc_enclave_result_t __Z_res = __insecure_read_file_impl(&retval , in_filename, in_filename_len, out_content, out_content_len);
   if (__Z_res != CC_SUCCESS) {
@@ -52,3 +56,97 @@ extern "C" int read_file(char* in_filename, int in_filename_len, char* out_conte
 
   return retval;
 }
+extern "C" int write_files(char* in_ids, int in_ids_len, char* in_contents, int in_contents_len) {
+  int retval;
+  PROFILE_SCOPE(PROF_WRITE_FILES, in_contents_len);
+
+  cc_enclave_result_t __Z_res = __insecure_write_files_impl(&retval , in_ids, in_ids_len, in_contents, in_contents_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+extern "C" int write_profile(char* in_trace, int in_trace_len) {
+  int retval;
+
+  cc_enclave_result_t __Z_res = __insecure_write_profile_impl(&retval , in_trace, in_trace_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+extern "C" int write_log(char* in_log, int in_log_len) {
+  int retval;
+
+  cc_enclave_result_t __Z_res = __insecure_write_log_impl(&retval , in_log, in_log_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+
+extern "C" int read_file_at(char* in_filename, int in_filename_len, int64_t offset, char* out_content, int out_content_len) {
+  int retval;
+  PROFILE_SCOPE(PROF_READ_FILE, out_content_len);
+
+  cc_enclave_result_t __Z_res = __insecure_read_file_at_impl(&retval , in_filename, in_filename_len, offset, out_content, out_content_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+extern "C" int write_file_at(char* in_filename, int in_filename_len, int64_t offset, char* in_content, int in_content_len) {
+  int retval;
+  PROFILE_SCOPE(PROF_WRITE_FILE, in_content_len);
+
+  cc_enclave_result_t __Z_res = __insecure_write_file_at_impl(&retval , in_filename, in_filename_len, offset, in_content, in_content_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+extern "C" int prefetch_file(char* in_filename, int in_filename_len, int64_t offset, int len, int handle) {
+  int retval;
+
+  cc_enclave_result_t __Z_res = __insecure_prefetch_file_impl(&retval , in_filename, in_filename_len, offset, len, handle);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+extern "C" int fetch_prefetched(int handle, char* out_content, int out_content_len) {
+  int retval;
+  PROFILE_SCOPE(PROF_READ_FILE, out_content_len);
+
+  cc_enclave_result_t __Z_res = __insecure_fetch_prefetched_impl(&retval , handle, out_content, out_content_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
+extern "C" int read_records(int cursor, char* out_records, int out_records_len) {
+  int retval;
+  PROFILE_SCOPE(PROF_READ_RECORDS, out_records_len);
+
+  cc_enclave_result_t __Z_res = __insecure_read_records_impl(&retval , cursor, out_records, out_records_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  }
+
+  return retval;
+}
\ No newline at end of file
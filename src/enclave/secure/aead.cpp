@@ -0,0 +1,269 @@
+#include "aead.h"
+
+#include <cstring>
+
+namespace {
+
+uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+void store32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+void store64(uint8_t *p, uint64_t v)
+{
+    store32(p, (uint32_t)v);
+    store32(p + 4, (uint32_t)(v >> 32));
+}
+
+uint32_t rotl(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b;                       \
+    d = rotl(d ^ a, 16);          \
+    c += d;                       \
+    b = rotl(b ^ c, 12);          \
+    a += b;                       \
+    d = rotl(d ^ a, 8);           \
+    c += d;                       \
+    b = rotl(b ^ c, 7);
+
+void chacha20_block(const uint8_t key[AEAD_KEY_SIZE], uint32_t counter,
+                    const uint8_t nonce[AEAD_NONCE_SIZE], uint8_t out[64])
+{
+    uint32_t in[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    for (int i = 0; i < 8; i++) in[4 + i] = load32(key + 4 * i);
+    in[12] = counter;
+    for (int i = 0; i < 3; i++) in[13 + i] = load32(nonce + 4 * i);
+
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12])
+        QUARTER_ROUND(x[1], x[5], x[9], x[13])
+        QUARTER_ROUND(x[2], x[6], x[10], x[14])
+        QUARTER_ROUND(x[3], x[7], x[11], x[15])
+        QUARTER_ROUND(x[0], x[5], x[10], x[15])
+        QUARTER_ROUND(x[1], x[6], x[11], x[12])
+        QUARTER_ROUND(x[2], x[7], x[8], x[13])
+        QUARTER_ROUND(x[3], x[4], x[9], x[14])
+    }
+    for (int i = 0; i < 16; i++) store32(out + 4 * i, x[i] + in[i]);
+}
+
+// xor data with the key stream starting at block counter
+void chacha20_xor(const uint8_t key[AEAD_KEY_SIZE], uint32_t counter,
+                  const uint8_t nonce[AEAD_NONCE_SIZE], uint8_t *data,
+                  size_t len)
+{
+    uint8_t block[64];
+    for (size_t pos = 0; pos < len; pos += 64, counter++) {
+        chacha20_block(key, counter, nonce, block);
+        size_t n = len - pos < 64 ? len - pos : 64;
+        for (size_t i = 0; i < n; i++) data[pos + i] ^= block[i];
+    }
+}
+
+// Poly1305 on 26 bit limbs, no 128 bit arithmetic needed
+class Poly1305
+{
+   public:
+    explicit Poly1305(const uint8_t key[32])
+    {
+        m_r[0] = load32(key + 0) & 0x3ffffff;
+        m_r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        m_r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        m_r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        m_r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+        memset(m_h, 0, sizeof(m_h));
+        for (int i = 0; i < 4; i++) m_pad[i] = load32(key + 16 + 4 * i);
+    }
+
+    // absorb data zero padded to a multiple of 16 bytes, as the AEAD
+    // construction does for the aad and the ciphertext
+    void update_padded(const uint8_t *data, size_t len)
+    {
+        size_t full = len & ~(size_t)15;
+        for (size_t pos = 0; pos < full; pos += 16) block(data + pos);
+        if (len > full) {
+            uint8_t last[16] = {0};
+            memcpy(last, data + full, len - full);
+            block(last);
+        }
+    }
+
+    void update(const uint8_t block16[16]) { block(block16); }
+
+    void finish(uint8_t tag[AEAD_TAG_SIZE])
+    {
+        uint32_t h0 = m_h[0], h1 = m_h[1], h2 = m_h[2], h3 = m_h[3],
+                 h4 = m_h[4];
+
+        uint32_t c = h1 >> 26;
+        h1 &= 0x3ffffff;
+        h2 += c;
+        c = h2 >> 26;
+        h2 &= 0x3ffffff;
+        h3 += c;
+        c = h3 >> 26;
+        h3 &= 0x3ffffff;
+        h4 += c;
+        c = h4 >> 26;
+        h4 &= 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        // h - p, selected when h >= p
+        uint32_t g0 = h0 + 5;
+        c = g0 >> 26;
+        g0 &= 0x3ffffff;
+        uint32_t g1 = h1 + c;
+        c = g1 >> 26;
+        g1 &= 0x3ffffff;
+        uint32_t g2 = h2 + c;
+        c = g2 >> 26;
+        g2 &= 0x3ffffff;
+        uint32_t g3 = h3 + c;
+        c = g3 >> 26;
+        g3 &= 0x3ffffff;
+        uint32_t g4 = h4 + c - (1u << 26);
+
+        uint32_t mask = (g4 >> 31) - 1;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+
+        h0 = h0 | (h1 << 26);
+        h1 = (h1 >> 6) | (h2 << 20);
+        h2 = (h2 >> 12) | (h3 << 14);
+        h3 = (h3 >> 18) | (h4 << 8);
+
+        uint64_t f = (uint64_t)h0 + m_pad[0];
+        store32(tag + 0, (uint32_t)f);
+        f = (uint64_t)h1 + m_pad[1] + (f >> 32);
+        store32(tag + 4, (uint32_t)f);
+        f = (uint64_t)h2 + m_pad[2] + (f >> 32);
+        store32(tag + 8, (uint32_t)f);
+        f = (uint64_t)h3 + m_pad[3] + (f >> 32);
+        store32(tag + 12, (uint32_t)f);
+    }
+
+   private:
+    void block(const uint8_t *m)
+    {
+        const uint32_t r0 = m_r[0], r1 = m_r[1], r2 = m_r[2], r3 = m_r[3],
+                       r4 = m_r[4];
+        const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+
+        uint32_t h0 = m_h[0] + (load32(m + 0) & 0x3ffffff);
+        uint32_t h1 = m_h[1] + ((load32(m + 3) >> 2) & 0x3ffffff);
+        uint32_t h2 = m_h[2] + ((load32(m + 6) >> 4) & 0x3ffffff);
+        uint32_t h3 = m_h[3] + ((load32(m + 9) >> 6) & 0x3ffffff);
+        uint32_t h4 = m_h[4] + ((load32(m + 12) >> 8) | (1u << 24));
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 +
+                      (uint64_t)h2 * s3 + (uint64_t)h3 * s2 +
+                      (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 +
+                      (uint64_t)h2 * s4 + (uint64_t)h3 * s3 +
+                      (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 +
+                      (uint64_t)h2 * r0 + (uint64_t)h3 * s4 +
+                      (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 +
+                      (uint64_t)h2 * r1 + (uint64_t)h3 * r0 +
+                      (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 +
+                      (uint64_t)h2 * r2 + (uint64_t)h3 * r1 +
+                      (uint64_t)h4 * r0;
+
+        uint32_t c = (uint32_t)(d0 >> 26);
+        h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += c;
+        c = (uint32_t)(d1 >> 26);
+        h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += c;
+        c = (uint32_t)(d2 >> 26);
+        h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += c;
+        c = (uint32_t)(d3 >> 26);
+        h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += c;
+        c = (uint32_t)(d4 >> 26);
+        h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        m_h[0] = h0;
+        m_h[1] = h1;
+        m_h[2] = h2;
+        m_h[3] = h3;
+        m_h[4] = h4;
+    }
+
+    uint32_t m_r[5];
+    uint32_t m_h[5];
+    uint32_t m_pad[4];
+};
+
+void compute_tag(const uint8_t key[AEAD_KEY_SIZE],
+                 const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                 size_t aad_len, const uint8_t *ciphertext, size_t len,
+                 uint8_t tag[AEAD_TAG_SIZE])
+{
+    // the one time Poly1305 key is the first half of key stream block 0
+    uint8_t block0[64];
+    chacha20_block(key, 0, nonce, block0);
+    Poly1305 poly(block0);
+    memset(block0, 0, sizeof(block0));
+
+    poly.update_padded(aad, aad_len);
+    poly.update_padded(ciphertext, len);
+    uint8_t lengths[16];
+    store64(lengths, aad_len);
+    store64(lengths + 8, len);
+    poly.update(lengths);
+    poly.finish(tag);
+}
+
+}  // namespace
+
+void aead_encrypt(const uint8_t key[AEAD_KEY_SIZE],
+                  const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                  size_t aad_len, uint8_t *data, size_t len,
+                  uint8_t tag[AEAD_TAG_SIZE])
+{
+    chacha20_xor(key, 1, nonce, data, len);
+    compute_tag(key, nonce, aad, aad_len, data, len, tag);
+}
+
+bool aead_decrypt(const uint8_t key[AEAD_KEY_SIZE],
+                  const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                  size_t aad_len, uint8_t *data, size_t len,
+                  const uint8_t tag[AEAD_TAG_SIZE])
+{
+    uint8_t expected[AEAD_TAG_SIZE];
+    compute_tag(key, nonce, aad, aad_len, data, len, expected);
+
+    // constant time compare
+    uint8_t diff = 0;
+    for (int i = 0; i < AEAD_TAG_SIZE; i++) diff |= expected[i] ^ tag[i];
+    if (diff != 0) return false;
+
+    chacha20_xor(key, 1, nonce, data, len);
+    return true;
+}
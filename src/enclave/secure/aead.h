@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// ChaCha20-Poly1305 (RFC 8439), encrypting and decrypting in place without
+// any allocation. Used for the chunks of the sealed gallery file, whose data
+// key is the only thing that goes through the platform seal.
+
+#define AEAD_KEY_SIZE 32
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+
+// encrypt len bytes of data in place and compute the tag over aad and the
+// ciphertext. a nonce must never be used twice with the same key
+void aead_encrypt(const uint8_t key[AEAD_KEY_SIZE],
+                  const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                  size_t aad_len, uint8_t *data, size_t len,
+                  uint8_t tag[AEAD_TAG_SIZE]);
+
+// check the tag and decrypt data in place, false (and data left encrypted) if
+// the ciphertext or aad were modified
+bool aead_decrypt(const uint8_t key[AEAD_KEY_SIZE],
+                  const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                  size_t aad_len, uint8_t *data, size_t len,
+                  const uint8_t tag[AEAD_TAG_SIZE]);
@@ -0,0 +1,136 @@
+#include "arena_allocator.h"
+
+#include <cstring>
+
+namespace {
+
+// size class used for blocks that did not fit into the arena
+const uint32_t HEAP_CLASS = 0xffffffff;
+
+struct BlockHeader
+{
+    uint32_t size_class;
+    uint32_t reserved;
+    size_t requested;
+};
+
+// keep the user pointer aligned the way ncnn expects
+const size_t HEADER_SIZE = NCNN_MALLOC_ALIGN;
+static_assert(sizeof(BlockHeader) <= HEADER_SIZE, "block header too large");
+
+inline int ceil_log2(size_t x)
+{
+    return x <= 1 ? 0 : 64 - __builtin_clzll((unsigned long long)(x - 1));
+}
+
+inline BlockHeader *header_of(void *ptr)
+{
+    return (BlockHeader *)((char *)ptr - HEADER_SIZE);
+}
+
+}  // namespace
+
+EnclaveArenaAllocator::EnclaveArenaAllocator(void *arena, size_t arena_size)
+    : m_top(0), m_arena_in_use(0), m_reset_per_inference(false)
+{
+    char *aligned = ncnn::alignPtr((char *)arena, NCNN_MALLOC_ALIGN);
+    size_t skipped = aligned - (char *)arena;
+
+    m_arena = aligned;
+    m_capacity = arena_size > skipped ? arena_size - skipped : 0;
+    memset(m_free_lists, 0, sizeof(m_free_lists));
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.capacity = m_capacity;
+}
+
+EnclaveArenaAllocator::~EnclaveArenaAllocator() {}
+
+void *EnclaveArenaAllocator::fastMalloc(size_t size)
+{
+    size_t total = size + HEADER_SIZE + NCNN_MALLOC_OVERREAD;
+    int cls = ceil_log2(total);
+    if (cls < MIN_CLASS_SHIFT) cls = MIN_CLASS_SHIFT;
+
+    char *block = nullptr;
+    if (cls < NUM_CLASSES) {
+        size_t block_size = (size_t)1 << cls;
+        if (m_free_lists[cls]) {
+            block = (char *)m_free_lists[cls];
+            m_free_lists[cls] = m_free_lists[cls]->next;
+        }
+        else if (m_top + block_size <= m_capacity) {
+            block = m_arena + m_top;
+            m_top += block_size;
+            m_stats.carved = m_top;
+            if (m_top > m_stats.high_water_mark) m_stats.high_water_mark = m_top;
+        }
+    }
+
+    if (!block) {
+        block = (char *)ncnn::fastMalloc(size + HEADER_SIZE);
+        if (!block) return nullptr;
+        cls = (int)HEAP_CLASS;
+        m_stats.num_fallbacks++;
+    }
+    else {
+        m_arena_in_use += size;
+    }
+
+    BlockHeader *header = (BlockHeader *)block;
+    header->size_class = (uint32_t)cls;
+    header->requested = size;
+
+    m_stats.num_allocs++;
+    m_stats.live_blocks++;
+    m_stats.in_use += size;
+    if (m_stats.in_use > m_stats.peak_in_use) m_stats.peak_in_use = m_stats.in_use;
+
+    return block + HEADER_SIZE;
+}
+
+void EnclaveArenaAllocator::fastFree(void *ptr)
+{
+    if (!ptr) return;
+
+    BlockHeader *header = header_of(ptr);
+    m_stats.live_blocks--;
+    m_stats.in_use -= header->requested;
+
+    if (header->size_class == HEAP_CLASS) {
+        ncnn::fastFree(header);
+        return;
+    }
+    m_arena_in_use -= header->requested;
+
+    if (m_reset_per_inference) return;
+
+    // the free list link overwrites the header
+    uint32_t cls = header->size_class;
+    FreeBlock *block = (FreeBlock *)header;
+    block->next = m_free_lists[cls];
+    m_free_lists[cls] = block;
+}
+
+void EnclaveArenaAllocator::set_reset_per_inference(bool enable)
+{
+    m_reset_per_inference = enable;
+}
+
+void EnclaveArenaAllocator::begin_inference()
+{
+    if (m_reset_per_inference && m_stats.live_blocks == 0) reset();
+}
+
+void EnclaveArenaAllocator::reset()
+{
+    memset(m_free_lists, 0, sizeof(m_free_lists));
+    m_top = 0;
+    m_arena_in_use = 0;
+    m_stats.carved = 0;
+}
+
+float EnclaveArenaAllocator::fragmentation() const
+{
+    if (m_stats.carved == 0) return 0.f;
+    return 1.f - (float)m_arena_in_use / (float)m_stats.carved;
+}
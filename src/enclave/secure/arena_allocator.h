@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "allocator.h"
+
+struct ArenaStats
+{
+    size_t capacity;         // bytes reserved for the arena
+    size_t carved;           // bytes handed out from the arena top so far
+    size_t high_water_mark;  // max value ever reached by carved
+    size_t in_use;           // bytes requested by live allocations
+    size_t peak_in_use;      // max value ever reached by in_use
+    size_t live_blocks;
+    size_t num_allocs;
+    size_t num_fallbacks;    // allocations served by the enclave heap
+};
+
+// ncnn allocator for the enclave.
+//
+// Requests are rounded up to a power-of-two size class. Every class keeps an
+// intrusive free list, new blocks are bump-allocated from a single arena, so
+// both fastMalloc and fastFree are O(1) and never touch the enclave heap.
+// Only when the arena is exhausted a request falls back to ncnn::fastMalloc.
+//
+// In reset-per-inference mode freed blocks are not recycled one by one: the
+// arena is rewound as a whole by begin_inference() once every block of the
+// previous inference has been released.
+//
+// Like ncnn::UnlockedPoolAllocator, this allocator is not thread-safe.
+class EnclaveArenaAllocator : public ncnn::Allocator
+{
+   public:
+    EnclaveArenaAllocator(void *arena, size_t arena_size);
+    virtual ~EnclaveArenaAllocator() override;
+
+    virtual void *fastMalloc(size_t size) override;
+    virtual void fastFree(void *ptr) override;
+
+    void set_reset_per_inference(bool enable);
+    void begin_inference();
+    // drop every block and rewind the arena, all blocks must be released
+    void reset();
+
+    const ArenaStats &stats() const { return m_stats; }
+    // share of the carved arena that is not backing live requested bytes,
+    // covering both size-class rounding and blocks idle in the free lists
+    float fragmentation() const;
+
+   private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    static const int MIN_CLASS_SHIFT = 7;
+    static const int NUM_CLASSES = 48;
+
+    char *m_arena;
+    size_t m_capacity;
+    size_t m_top;
+    size_t m_arena_in_use;
+    bool m_reset_per_inference;
+    FreeBlock *m_free_lists[NUM_CLASSES];
+    ArenaStats m_stats;
+};
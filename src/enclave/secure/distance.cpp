@@ -0,0 +1,354 @@
+#include "distance.h"
+
+#include "cpu.h"
+#include "quantize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DIST_X86 1
+#endif
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#define DIST_RVV 1
+#endif
+
+namespace {
+
+typedef void (*block_kernel)(const float *, const float *, int, float *);
+typedef void (*s8_kernel)(const float *, const int8_t *, int, float *);
+typedef void (*f16_kernel)(const float *, const uint16_t *, int, float *);
+
+void l2_block_c(const float *probe, const float *block, int dim, float *out)
+{
+    for (int r = 0; r < DIST_BLOCK; r++) out[r] = 0.f;
+    for (int d = 0; d < dim; d++) {
+        const float p = probe[d];
+        const float *g = block + d * DIST_BLOCK;
+        for (int r = 0; r < DIST_BLOCK; r++) {
+            float diff = g[r] - p;
+            out[r] += diff * diff;
+        }
+    }
+}
+
+void dot_block_c(const float *probe, const float *block, int dim, float *out)
+{
+    for (int r = 0; r < DIST_BLOCK; r++) out[r] = 0.f;
+    for (int d = 0; d < dim; d++) {
+        const float p = probe[d];
+        const float *g = block + d * DIST_BLOCK;
+        for (int r = 0; r < DIST_BLOCK; r++) out[r] += g[r] * p;
+    }
+}
+
+void dot_block_s8_c(const float *probe, const int8_t *block, int dim,
+                    float *out)
+{
+    for (int r = 0; r < DIST_BLOCK; r++) out[r] = 0.f;
+    for (int d = 0; d < dim; d++) {
+        const float p = probe[d];
+        const int8_t *g = block + d * DIST_BLOCK;
+        for (int r = 0; r < DIST_BLOCK; r++) out[r] += g[r] * p;
+    }
+}
+
+void dot_block_f16_c(const float *probe, const uint16_t *block, int dim,
+                     float *out)
+{
+    for (int r = 0; r < DIST_BLOCK; r++) out[r] = 0.f;
+    for (int d = 0; d < dim; d++) {
+        const float p = probe[d];
+        const uint16_t *g = block + d * DIST_BLOCK;
+        for (int r = 0; r < DIST_BLOCK; r++) out[r] += half_to_float(g[r]) * p;
+    }
+}
+
+#if DIST_X86
+static_assert(DIST_BLOCK == 16, "x86 kernels assume 16 rows per block");
+
+__attribute__((target("avx2,fma"))) void l2_block_avx2(const float *probe,
+                                                       const float *block,
+                                                       int dim, float *out)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m256 p = _mm256_set1_ps(probe[d]);
+        __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(block), p);
+        __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(block + 8), p);
+        acc0 = _mm256_fmadd_ps(diff0, diff0, acc0);
+        acc1 = _mm256_fmadd_ps(diff1, diff1, acc1);
+        block += DIST_BLOCK;
+    }
+    _mm256_storeu_ps(out, acc0);
+    _mm256_storeu_ps(out + 8, acc1);
+}
+
+__attribute__((target("avx2,fma"))) void dot_block_avx2(const float *probe,
+                                                        const float *block,
+                                                        int dim, float *out)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m256 p = _mm256_set1_ps(probe[d]);
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(block), p, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(block + 8), p, acc1);
+        block += DIST_BLOCK;
+    }
+    _mm256_storeu_ps(out, acc0);
+    _mm256_storeu_ps(out + 8, acc1);
+}
+
+__attribute__((target("avx512f"))) void l2_block_avx512(const float *probe,
+                                                        const float *block,
+                                                        int dim, float *out)
+{
+    __m512 acc = _mm512_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m512 diff =
+            _mm512_sub_ps(_mm512_loadu_ps(block), _mm512_set1_ps(probe[d]));
+        acc = _mm512_fmadd_ps(diff, diff, acc);
+        block += DIST_BLOCK;
+    }
+    _mm512_storeu_ps(out, acc);
+}
+
+__attribute__((target("avx512f"))) void dot_block_avx512(const float *probe,
+                                                         const float *block,
+                                                         int dim, float *out)
+{
+    __m512 acc = _mm512_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(block), _mm512_set1_ps(probe[d]),
+                              acc);
+        block += DIST_BLOCK;
+    }
+    _mm512_storeu_ps(out, acc);
+}
+// avx2 implies f16c in ncnn::cpu_support_x86_avx2
+__attribute__((target("avx2,fma"))) void dot_block_s8_avx2(const float *probe,
+                                                           const int8_t *block,
+                                                           int dim, float *out)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m256 p = _mm256_set1_ps(probe[d]);
+        __m128i q = _mm_loadu_si128((const __m128i *)block);
+        __m256 g0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q));
+        __m256 g1 =
+            _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q, 8)));
+        acc0 = _mm256_fmadd_ps(g0, p, acc0);
+        acc1 = _mm256_fmadd_ps(g1, p, acc1);
+        block += DIST_BLOCK;
+    }
+    _mm256_storeu_ps(out, acc0);
+    _mm256_storeu_ps(out + 8, acc1);
+}
+
+__attribute__((target("avx2,fma,f16c"))) void dot_block_f16_avx2(
+    const float *probe, const uint16_t *block, int dim, float *out)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m256 p = _mm256_set1_ps(probe[d]);
+        __m256 g0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)block));
+        __m256 g1 =
+            _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(block + 8)));
+        acc0 = _mm256_fmadd_ps(g0, p, acc0);
+        acc1 = _mm256_fmadd_ps(g1, p, acc1);
+        block += DIST_BLOCK;
+    }
+    _mm256_storeu_ps(out, acc0);
+    _mm256_storeu_ps(out + 8, acc1);
+}
+
+// the conversions take their full-mask maskz forms: the plain intrinsics pass
+// an undefined vector as the merge source, which GCC reports as
+// maybe-uninitialized at -O2
+#define DIST_ALL_LANES ((__mmask16)0xffff)
+
+__attribute__((target("avx512f"))) void dot_block_s8_avx512(
+    const float *probe, const int8_t *block, int dim, float *out)
+{
+    __m512 acc = _mm512_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m512 g = _mm512_maskz_cvtepi32_ps(
+            DIST_ALL_LANES,
+            _mm512_maskz_cvtepi8_epi32(
+                DIST_ALL_LANES, _mm_loadu_si128((const __m128i *)block)));
+        acc = _mm512_fmadd_ps(g, _mm512_set1_ps(probe[d]), acc);
+        block += DIST_BLOCK;
+    }
+    _mm512_storeu_ps(out, acc);
+}
+
+__attribute__((target("avx512f"))) void dot_block_f16_avx512(
+    const float *probe, const uint16_t *block, int dim, float *out)
+{
+    __m512 acc = _mm512_setzero_ps();
+    for (int d = 0; d < dim; d++) {
+        __m512 g = _mm512_maskz_cvtph_ps(
+            DIST_ALL_LANES, _mm256_loadu_si256((const __m256i *)block));
+        acc = _mm512_fmadd_ps(g, _mm512_set1_ps(probe[d]), acc);
+        block += DIST_BLOCK;
+    }
+    _mm512_storeu_ps(out, acc);
+}
+#endif  // DIST_X86
+
+#if DIST_RVV
+// the block is walked in strips of vl rows, a single strip when
+// VLEN * 4 >= 32 * DIST_BLOCK
+void l2_block_rvv(const float *probe, const float *block, int dim, float *out)
+{
+    for (size_t lane = 0; lane < DIST_BLOCK;) {
+        size_t vl = __riscv_vsetvl_e32m4(DIST_BLOCK - lane);
+        vfloat32m4_t acc = __riscv_vfmv_v_f_f32m4(0.f, vl);
+        const float *g = block + lane;
+        for (int d = 0; d < dim; d++) {
+            vfloat32m4_t diff =
+                __riscv_vfsub_vf_f32m4(__riscv_vle32_v_f32m4(g, vl), probe[d], vl);
+            acc = __riscv_vfmacc_vv_f32m4(acc, diff, diff, vl);
+            g += DIST_BLOCK;
+        }
+        __riscv_vse32_v_f32m4(out + lane, acc, vl);
+        lane += vl;
+    }
+}
+
+void dot_block_rvv(const float *probe, const float *block, int dim, float *out)
+{
+    for (size_t lane = 0; lane < DIST_BLOCK;) {
+        size_t vl = __riscv_vsetvl_e32m4(DIST_BLOCK - lane);
+        vfloat32m4_t acc = __riscv_vfmv_v_f_f32m4(0.f, vl);
+        const float *g = block + lane;
+        for (int d = 0; d < dim; d++) {
+            acc = __riscv_vfmacc_vf_f32m4(acc, probe[d],
+                                          __riscv_vle32_v_f32m4(g, vl), vl);
+            g += DIST_BLOCK;
+        }
+        __riscv_vse32_v_f32m4(out + lane, acc, vl);
+        lane += vl;
+    }
+}
+// e8m1 and e16m2 have the same lanes per vsetvl as e32m4
+void dot_block_s8_rvv(const float *probe, const int8_t *block, int dim,
+                      float *out)
+{
+    for (size_t lane = 0; lane < DIST_BLOCK;) {
+        size_t vl = __riscv_vsetvl_e32m4(DIST_BLOCK - lane);
+        vfloat32m4_t acc = __riscv_vfmv_v_f_f32m4(0.f, vl);
+        const int8_t *g = block + lane;
+        for (int d = 0; d < dim; d++) {
+            vint32m4_t q =
+                __riscv_vsext_vf4_i32m4(__riscv_vle8_v_i8m1(g, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(
+                acc, probe[d], __riscv_vfcvt_f_x_v_f32m4(q, vl), vl);
+            g += DIST_BLOCK;
+        }
+        __riscv_vse32_v_f32m4(out + lane, acc, vl);
+        lane += vl;
+    }
+}
+
+#if defined(__riscv_zvfhmin)
+void dot_block_f16_rvv(const float *probe, const uint16_t *block, int dim,
+                       float *out)
+{
+    for (size_t lane = 0; lane < DIST_BLOCK;) {
+        size_t vl = __riscv_vsetvl_e32m4(DIST_BLOCK - lane);
+        vfloat32m4_t acc = __riscv_vfmv_v_f_f32m4(0.f, vl);
+        const uint16_t *g = block + lane;
+        for (int d = 0; d < dim; d++) {
+            vfloat16m2_t h = __riscv_vle16_v_f16m2((const _Float16 *)g, vl);
+            acc = __riscv_vfmacc_vf_f32m4(
+                acc, probe[d], __riscv_vfwcvt_f_f_v_f32m4(h, vl), vl);
+            g += DIST_BLOCK;
+        }
+        __riscv_vse32_v_f32m4(out + lane, acc, vl);
+        lane += vl;
+    }
+}
+#else
+#define dot_block_f16_rvv dot_block_f16_c
+#endif
+#endif  // DIST_RVV
+
+struct Kernels
+{
+    block_kernel l2;
+    block_kernel dot;
+    s8_kernel dot_s8;
+    f16_kernel dot_f16;
+    const char *isa;
+};
+
+Kernels select_kernels()
+{
+#if DIST_RVV
+    if (ncnn::cpu_support_riscv_v())
+        return {l2_block_rvv, dot_block_rvv, dot_block_s8_rvv,
+                dot_block_f16_rvv, "rvv"};
+#endif
+#if DIST_X86
+    if (ncnn::cpu_support_x86_avx512())
+        return {l2_block_avx512, dot_block_avx512, dot_block_s8_avx512,
+                dot_block_f16_avx512, "avx512"};
+    if (ncnn::cpu_support_x86_avx2())
+        return {l2_block_avx2, dot_block_avx2, dot_block_s8_avx2,
+                dot_block_f16_avx2, "avx2"};
+#endif
+    return {l2_block_c, dot_block_c, dot_block_s8_c, dot_block_f16_c, "c"};
+}
+
+const Kernels &kernels()
+{
+    static const Kernels k = select_kernels();
+    return k;
+}
+
+}  // namespace
+
+void l2_block(const float *probe, const float *block, int dim,
+              float out[DIST_BLOCK])
+{
+    kernels().l2(probe, block, dim, out);
+}
+
+void dot_block(const float *probe, const float *block, int dim,
+               float out[DIST_BLOCK])
+{
+    kernels().dot(probe, block, dim, out);
+}
+
+void dot_block_s8(const float *probe, const int8_t *block, int dim,
+                  float out[DIST_BLOCK])
+{
+    kernels().dot_s8(probe, block, dim, out);
+}
+
+void dot_block_f16(const float *probe, const uint16_t *block, int dim,
+                   float out[DIST_BLOCK])
+{
+    kernels().dot_f16(probe, block, dim, out);
+}
+
+const char *distance_isa() { return kernels().isa; }
+
+void push_top_k(int k, int &cnt, int *ids, float *dists, int id, float dist)
+{
+    if (cnt == k && dist >= dists[k - 1]) return;
+
+    int pos = cnt < k ? cnt++ : k - 1;
+    while (pos > 0 && dists[pos - 1] > dist) {
+        ids[pos] = ids[pos - 1];
+        dists[pos] = dists[pos - 1];
+        pos--;
+    }
+    ids[pos] = id;
+    dists[pos] = dist;
+}
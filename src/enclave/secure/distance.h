@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+enum DistanceMetric
+{
+    DISTANCE_L2,      // squared euclidean distance
+    DISTANCE_COSINE,  // 1 - cosine similarity, rows and probe are normalized
+};
+
+// rows scored together by one kernel call
+#define DIST_BLOCK 16
+
+// Gallery blocks are stored as structure of arrays: component d of row r of a
+// block is at block[d * DIST_BLOCK + r], so a kernel streams over the
+// components and keeps DIST_BLOCK accumulators in vector registers.
+//
+// The kernels are picked once at runtime: RISC-V Vector on the Penglai target
+// when the enclave is built with V enabled, AVX-512 or AVX2 on x86, plain C
+// otherwise.
+
+// out[r] = squared L2 distance between probe and row r
+void l2_block(const float *probe, const float *block, int dim,
+              float out[DIST_BLOCK]);
+// out[r] = inner product of probe and row r
+void dot_block(const float *probe, const float *block, int dim,
+               float out[DIST_BLOCK]);
+
+// out[r] = inner product of probe and row r of an int8 block, without the
+// per-row scale
+void dot_block_s8(const float *probe, const int8_t *block, int dim,
+                  float out[DIST_BLOCK]);
+// out[r] = inner product of probe and row r of a binary16 block
+void dot_block_f16(const float *probe, const uint16_t *block, int dim,
+                   float out[DIST_BLOCK]);
+
+// name of the instruction set the kernels run on
+const char *distance_isa();
+
+// keep the k smallest distances seen so far in ids/dists in ascending order,
+// cnt is the number kept
+void push_top_k(int k, int &cnt, int *ids, float *dists, int id, float dist);
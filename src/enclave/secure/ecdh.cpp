@@ -17,10 +17,14 @@ extern "C" {
 #include <cstring>
 #include <vector>
 #include "TEE-Capability/common.h"
+#include "enclave_log.h"
+#include "sealing.h"
 #define PRIVATE_KEY_SIZE 32
 #define PUBLIC_KEY_SIZE 64
 #define HASH_SIZE 32
 #define SIGNATURE_SIZE 64
+// the shared point the session key is taken from
+#define SESSION_KEY_SIZE PUBLIC_KEY_SIZE
 
 #define NONCE 12345
 #define ROUND_TO(x, align) (((x) + ((align)-1)) & ~((align)-1))
@@ -191,23 +195,33 @@ extern "C" {
             return buf_len;
         }
 
+        if (sealed_key_len < 0 || sealed_key_len > buf_len - 8) {
+            LOG_ERROR("MALFORMED SEALED SESSION KEY\n");
+            memset(buf, 0, buf_len);
+            return 0;
+        }
+
         p_buf -= sealed_key_len;
-        char* key_buf = p_buf;
-        unseal_data_inplace(key_buf, sealed_key_len);
-                        for (int i = 0; i < 64; i++) {
-                            eapp_print("%x\n",
-                                   (unsigned char)key_buf[i]);
-                        }
-        
+        char key_buf[SESSION_KEY_SIZE] = {0};
+        if (unseal_into(p_buf, sealed_key_len, key_buf, sizeof(key_buf)) < 0) {
+            // the ecall gets no input rather than the ciphertext
+            memset(key_buf, 0, sizeof(key_buf));
+            memset(buf, 0, buf_len);
+            LOG_ERROR("CANNOT UNSEAL SESSION KEY\n");
+            return 0;
+        }
+
         p_buf -= 4;
         int origin_data_len = *(int*)p_buf;
         
 
         _Z_decrypt((const unsigned char*)key_buf, (unsigned char*)buf, (origin_data_len + 15) / 16 * 16);
+        memset(key_buf, 0, sizeof(key_buf));
         return origin_data_len;
     }
 
     // ENCRYPTED_DATA | OUT_LEN(4B) | SEALED_KEY | SEALED_KEY_LEN(4B) | DECRYPTED(1B)
+    // the results are wiped when the session key is unusable
     void __encrypt_in_enclave(char* buf, int buf_len, const char* func_name) {
         if (strcmp(func_name, "ecall___secure_key_exchange_impl") == 0) return;
         char *p_buf = buf + buf_len;
@@ -217,16 +231,28 @@ extern "C" {
 
         p_buf -= 4;
         int sealed_key_len = *(int*)p_buf;
+        if (sealed_key_len < 0 || sealed_key_len > buf_len - 9) {
+            LOG_ERROR("MALFORMED SEALED SESSION KEY\n");
+            memset(buf, 0, buf_len);
+            return;
+        }
 
         p_buf -= sealed_key_len;
-        char *key_buf = p_buf;
-        unseal_data_inplace(key_buf, sealed_key_len);
+        char key_buf[SESSION_KEY_SIZE] = {0};
+        if (unseal_into(p_buf, sealed_key_len, key_buf, sizeof(key_buf)) < 0) {
+            // never encrypt the results under a key the host can guess
+            memset(key_buf, 0, sizeof(key_buf));
+            memset(buf, 0, p_buf - 4 - buf);
+            LOG_ERROR("CANNOT UNSEAL SESSION KEY\n");
+            return;
+        }
 
         p_buf -= 4;
         int out_len = *(int*)p_buf;
-        eapp_print("OUT LEN: %d\n", out_len);
+        LOG_DEBUG("OUT LEN: %d\n", out_len);
 
         _Z_encrypt((const unsigned char*)key_buf, (unsigned char*)buf, (out_len + 15) / 16 * 16);
+        memset(key_buf, 0, sizeof(key_buf));
 
         *(int*)(buf + buf_len - 4 - 1) = out_len;
     }
@@ -269,6 +295,7 @@ extern "C" {
 }
 
 int key_exchange(char* in_key, int in_key_len, char* out_key, int out_key_len, char* out_encrypted_shared_key, int out_encrypted_shared_key_len, char* out_key_signature, int out_key_signature_len) {
+    LogScope log_scope;
     char pri_key[32];
     char pub_key[64];
     char signature[64];
@@ -282,18 +309,12 @@ int key_exchange(char* in_key, int in_key_len, char* out_key, int out_key_len, c
     
     const auto pri = std::string(pri_key, pri_key + sizeof(pri_key));
     const auto shared = make_shared_key(pri, in_pub_key);
-    eapp_print("shared key: \n");
-                        for (int i = 0; i < 64; i++) {
-                            eapp_print("%x\n",
-                                   (unsigned char)shared[i]);
-                        }
 
     memcpy(out_key, pub_key, out_key_len);
 
-    std::vector<char> shared_key(shared.begin(), shared.end());
-    shared_key.resize(shared_key.size() + 200);
-    int sealed_len = seal_data_inplace(shared_key.data(), shared_key.size(), shared.size());
-    memcpy(out_encrypted_shared_key, shared_key.data(), sealed_len);
+    std::vector<char> sealed_key(shared.size() + 200);
+    int sealed_len = seal_into(shared.data(), shared.size(), sealed_key.data(), sealed_key.size());
+    if (sealed_len > 0) memcpy(out_encrypted_shared_key, sealed_key.data(), sealed_len);
     return sealed_len;
 }
 
@@ -10,9 +10,21 @@ extern "C" {
 
 #define img_recorder __secure_img_recorder_impl
 #define img_verifier __secure_img_verifier_impl
+#define img_recorder_batch __secure_img_recorder_batch_impl
+#define pq_train __secure_pq_train_impl
 
 #include "embedding.h"
 
+#include "arena_allocator.h"
+#include "gallery.h"
+#include "gallery_store.h"
+#include "enclave_log.h"
+#include "memory_planner.h"
+#include "profiler.h"
+#include "rvv_layers.h"
+#include "sealing.h"
+#include "thread_pool.h"
+
 #include "../insecure/file.h"
 #include "datareader.h"
 // #include "mobilefacenet.bin.inc"
@@ -25,110 +37,76 @@ extern "C" {
 #include "simpleocv.h"
 // int __fprintf_chk(FILE *, int, const char *, ...);
 // int __sprintf_chk(char *, int, size_t, const char *, ...);
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>  // 用于memset
 #include <filesystem>
 #include <fstream>
 #include <regex>
-#include <unordered_map>
 #include <vector>
 
 #define INF 1000000
 
 constexpr float THRESHOLD = 8;
+// accepted distance when the gallery compares by DISTANCE_COSINE
+constexpr float COSINE_THRESHOLD = 0.5f;
+
+// DISTANCE_L2 on raw embeddings, or DISTANCE_COSINE
+#define GALLERY_METRIC DISTANCE_L2
+// gallery size from which verification searches an IVF index instead of
+// scanning every entry, 0 keeps the exhaustive scan
+#define GALLERY_IVF_TRAIN_SIZE 4096
+// inverted lists scanned per verification, higher gives better recall
+#define GALLERY_IVF_NPROBE 8
+// STORAGE_INT8 or STORAGE_FP16 keep the resident gallery in reduced precision
+// for large galleries, STORAGE_PQ keeps GALLERY_PQ_M byte codes once pq_train
+// has been run. the best GALLERY_RERANK_K candidates are then re-ranked on
+// their sealed float records
+#define GALLERY_STORAGE STORAGE_FLOAT32
+#define GALLERY_RERANK_K 8
+#define GALLERY_PQ_M 16
+// keep the gallery in the chunked GALLERY_FILE of gallery_store.h, encrypted
+// under one sealed data key, instead of a platform sealed emb<id>.bin per face
+#define GALLERY_SEALED_CHUNKS 1
+// verify against the gallery file streamed through the enclave instead of
+// the resident gallery, for galleries larger than enclave memory. the
+// GALLERY_STREAM_TOP_K nearest faces are kept while streaming
+#define GALLERY_STREAMING 0
+#define GALLERY_STREAM_TOP_K 5
+
+// replay a liveness-based static plan computed from the first inference, so
+// that inferences run inside one arena sized to the peak live set
+#define ENCLAVE_MEMORY_PLAN 1
+
+// rewind the whole arena before every inference instead of recycling blocks
+// through the size-class free lists (only without ENCLAVE_MEMORY_PLAN)
+#define ARENA_RESET_PER_INFERENCE 0
+
+// replace the depthwise 3x3, pointwise 1x1 and PReLU layers with the RVV
+// kernels of rvv_layers.h and fuse every PReLU into its conv
+#define ENCLAVE_RVV_LAYERS 1
+// threads the layers of rvv_layers.h split their channel loops over, the
+// pool falls back to the calling thread where no threads can be started. the
+// enclave ncnn is built with NCNN_THREADS 0, its own layers stay on one thread
+#define ENCLAVE_NUM_THREADS 4
+
+// run the int8 MobileFaceNet generated by scripts/calibrate_int8.sh instead
+// of the fp32 one
+#define EMBEDDING_MODEL_INT8 0
+// with the int8 model, also run the fp32 model on every face and print how far
+// the int8 embedding drifts from it
+#define INT8_DRIFT_REPORT 0
+
+#if EMBEDDING_MODEL_INT8
+#if !NCNN_INT8
+#error "EMBEDDING_MODEL_INT8 needs an enclave ncnn built with NCNN_INT8"
+#endif
+#include "mobilefacenet_int8.id.h"
+#include "mobilefacenet_int8.mem.h"
+#endif
 
 
-class BitmapMemoryPool : public ncnn::Allocator
-{
-   private:
-    void *pool;  // 内存池的起始地址
-    size_t blockSize;
-    size_t poolSize;
-    size_t numBlocks;
-    std::vector<uint8_t> bitmap;  // 位图，用于追踪每个块的占用情况
-    std::unordered_map<size_t, size_t> allocatedMap;
-
-   public:
-    BitmapMemoryPool(void *memPool, size_t poolSize, size_t blockSize)
-        : pool(memPool), poolSize(poolSize), blockSize(blockSize)
-    {
-        numBlocks = poolSize / blockSize;
-        bitmap.resize((numBlocks + 7) / 8,
-                      0);  // 初始化位图，所有位都设置为0（空闲）
-    }
-
-    virtual ~BitmapMemoryPool() override {}
-
-    virtual void *fastMalloc(size_t size) override
-    {
-        size_t numBlocksNeeded =
-            (size + blockSize - 1) / blockSize;  // 计算所需的块数
-        size_t startBlock = findFreeBlocks(numBlocksNeeded);  // 查找连续空闲块
-
-        if (startBlock == size_t(-1)) {
-            eapp_print("NO BLOCKS\n");
-            *(char *)0 = 0;
-            return nullptr;  // 找不到足够的连续空闲块
-        }
-
-        // 标记这些块为已分配
-        for (size_t i = 0; i < numBlocksNeeded; ++i) {
-            setBlockUsed(startBlock + i);
-        }
-
-        allocatedMap.emplace(startBlock, numBlocksNeeded);
-        // eapp_print("ALLOC: %d blocks at %d\n", numBlocksNeeded, startBlock);
-        return static_cast<char *>(pool) + startBlock * blockSize;
-    }
-
-    virtual void fastFree(void *ptr) override
-    {
-        if (!ptr) return;  // 空指针，无需操作
-
-        size_t blockIndex =
-            (static_cast<char *>(ptr) - static_cast<char *>(pool)) / blockSize;
-        size_t numBlocksNeeded = allocatedMap[blockIndex];
-        for (size_t i = 0; i < numBlocksNeeded; ++i)
-            setBlockFree(i + blockIndex);
-    }
-
-   private:
-    // 查找连续的空闲块
-    size_t findFreeBlocks(size_t numBlocksNeeded)
-    {
-        for (size_t i = 0; i <= numBlocks - numBlocksNeeded; ++i) {
-            bool found = true;
-            for (size_t j = 0; j < numBlocksNeeded; ++j) {
-                if (isBlockUsed(i + j)) {
-                    found = false;
-                    i += j;  // 优化搜索，跳过检查过的已占用的块
-                    break;
-                }
-            }
-            if (found) {
-                return i;
-            }
-        }
-        return size_t(-1);  // 没有找到
-    }
-
-    bool isBlockUsed(size_t blockIndex)
-    {
-        return bitmap[blockIndex / 8] & (1 << (blockIndex % 8));
-    }
-
-    void setBlockUsed(size_t blockIndex)
-    {
-        bitmap[blockIndex / 8] |= (1 << (blockIndex % 8));
-    }
-
-    void setBlockFree(size_t blockIndex)
-    {
-        bitmap[blockIndex / 8] &= ~(1 << (blockIndex % 8));
-    }
-};
-
 bool check_nan(float f)
 {
     unsigned int *bits = (unsigned int *)&f;
@@ -136,63 +114,143 @@ bool check_nan(float f)
     return (((*bits) & 0x7F800000) == 0x7F800000) &&
            (((*bits) & 0x007FFFFF) != 0);
 }
-void print_num(int num) { eapp_print("%d", num); }
+void print_num(int num) { LOG_INFO("%d", num); }
 
 void print_float(float num)
 {
     // check num is nan
     if (check_nan(num)) {
-        eapp_print("nan\n");
+        LOG_INFO("nan\n");
         return;
     }
     print_num((int)(num * 10000));
 }
-int embedding(in_char img[IMG_SIZE], out_char res[EMBEDDING_SIZE])
+
+struct EmbeddingModel
 {
-    ncnn::Net net;
+    const unsigned char *param_bin;
+    const unsigned char *bin;
+    int input_blob;
+    int output_blob;
+    bool int8;
+};
+
+static const EmbeddingModel FP32_MODEL = {
+    mobilefacenet_param_bin, mobilefacenet_bin,
+    mobilefacenet_param_id::BLOB_data, mobilefacenet_param_id::BLOB_fc1,
+    false};
+#if EMBEDDING_MODEL_INT8
+static const EmbeddingModel INT8_MODEL = {
+    mobilefacenet_int8_param_bin, mobilefacenet_int8_bin,
+    mobilefacenet_int8_param_id::BLOB_data,
+    mobilefacenet_int8_param_id::BLOB_fc1, true};
+static const EmbeddingModel &MODEL = INT8_MODEL;
+#else
+static const EmbeddingModel &MODEL = FP32_MODEL;
+#endif
 
+static ncnn::Net *load_net(const EmbeddingModel &model)
+{
+    ncnn::Net *net = new ncnn::Net;
 #ifdef __TEE
-    const int POOL_SIZE = 1024 * 1024 * 50;
-    auto pool = new BitmapMemoryPool(malloc(POOL_SIZE), POOL_SIZE, 1024 * 16);
-    // eapp_print("POOL CREATED\n");
-    net.opt.use_vulkan_compute = false;
-    net.opt.blob_allocator = pool;
-    net.opt.workspace_allocator = pool;
+    net->opt.use_vulkan_compute = false;
+#endif
+    net->opt.use_int8_inference = model.int8;
+    init_shared_thread_pool(ENCLAVE_NUM_THREADS);
+    net->opt.num_threads = shared_thread_pool()->num_threads();
+    if (net->opt.num_threads < ENCLAVE_NUM_THREADS) {
+        LOG_WARN("STARTED %d OF %d WORKER THREADS\n",
+                 net->opt.num_threads - 1, ENCLAVE_NUM_THREADS - 1);
+    }
+#if ENCLAVE_RVV_LAYERS
+    register_rvv_layers(net);
 #endif
     /* const unsigned char *mobilefacenet_param_ptr = mobilefacenet_param; */
     /* const unsigned char *mobilefacenet_bin_ptr = mobilefacenet_bin; */
-    net.load_param(mobilefacenet_param_bin);
-    eapp_print("LOADED PARAM\n");
-    net.load_model(mobilefacenet_bin);
-    eapp_print("LOADED MODEL\n");
+    {
+        PROFILE_SCOPE(PROF_LOAD_MODEL, model.int8);
+        net->load_param(model.param_bin);
+        LOG_DEBUG("LOADED PARAM\n");
+        net->load_model(model.bin);
+        LOG_INFO("LOADED MODEL%s\n", model.int8 ? " (INT8)" : "");
+    }
+#if ENCLAVE_RVV_LAYERS
+    int fused = fuse_rvv_prelu(net);
+    LOG_INFO("FUSED PRELU: %d, LAYER KERNELS: %s, THREADS: %d\n", fused,
+             rvv_layers_isa(), net->opt.num_threads);
+#endif
+#if ENCLAVE_PROFILE
+    profile_net_layers(net);
+#endif
     /* if
      * (net.load_param_bin(ncnn::DataReaderFromMemory(mobilefacenet_param_ptr)))
      */
     /*   exit(-1); */
     /* if (net.load_model(ncnn::DataReaderFromMemory(mobilefacenet_bin_ptr))) */
     /*   exit(-1); */
+    return net;
+}
 
-    ncnn::Mat input = ncnn::Mat::from_pixels(
-        (const unsigned char *)img, ncnn::Mat::PIXEL_RGB, WIDTH, HEIGHT);
-    for (int q = 0; q < input.c; q++) {
-        float *ptr = input.channel(q);
-        for (int i = 0; i < input.w * input.h; i++) {
-            ptr[i] = ptr[i] * (1.f);
-        }
+// The MobileFaceNet instance lives for the whole lifetime of the enclave: the
+// param/model are parsed and the layer pipelines are created on the first
+// ECALL only, every later inference just creates its own Extractor.
+static ncnn::Net *g_net = nullptr;
+static EnclaveArenaAllocator *g_arena = nullptr;
+static StaticPlanAllocator *g_planner = nullptr;
+
+static ncnn::Net *get_net()
+{
+    if (g_net) return g_net;
+
+    ncnn::Net *net = load_net(MODEL);
+
+#ifdef __TEE
+    // installed after load_model so that weights transformed while creating
+    // the pipelines stay on the heap and the arena only holds blobs
+#if ENCLAVE_MEMORY_PLAN
+    g_planner = new StaticPlanAllocator();
+    net->opt.blob_allocator = g_planner;
+    net->opt.workspace_allocator = g_planner;
+#else
+    const int POOL_SIZE = 1024 * 1024 * 50;
+    void *pool = malloc(POOL_SIZE);
+    if (pool) {
+        g_arena = new EnclaveArenaAllocator(pool, POOL_SIZE);
+        g_arena->set_reset_per_inference(ARENA_RESET_PER_INFERENCE);
+        net->opt.blob_allocator = g_arena;
+        net->opt.workspace_allocator = g_arena;
     }
+    else {
+        // keep ncnn's default allocators
+        LOG_WARN("NO MEMORY FOR THE %d MB ARENA\n", POOL_SIZE >> 20);
+    }
+#endif
+#endif
+
+    g_net = net;
+    return g_net;
+}
+
+// run net on img and write the flattened output blob to out
+static void forward(const ncnn::Net *net, const EmbeddingModel &model,
+                    in_char img[IMG_SIZE], float out[EMB_LEN])
+{
+    ncnn::Mat input = ncnn::Mat::from_pixels(
+        (const unsigned char *)img, ncnn::Mat::PIXEL_RGB, WIDTH, HEIGHT,
+        net->opt.blob_allocator);
+    // the embedded model takes raw RGB pixels, there is no input scaling
 
     ncnn::Mat output;
 retry: {
-    ncnn::Extractor extractor = net.create_extractor();
-    extractor.input(mobilefacenet_param_id::BLOB_data, input);
+    ncnn::Extractor extractor = net->create_extractor();
+    extractor.input(model.input_blob, input);
 
-    eapp_print("BEGIN INVOKE\n");
-    extractor.extract(mobilefacenet_param_id::BLOB_fc1, output);
+    LOG_DEBUG("BEGIN INVOKE\n");
+    extractor.extract(model.output_blob, output);
 }
 
     ncnn::Mat out_flatterned = output.reshape(output.w * output.h * output.c);
 
-    float *out = (float *)res;
     if (check_nan(out_flatterned[0])) goto retry;
     TEE_ASSERT(
         out_flatterned.w * out_flatterned.h * out_flatterned.c == EMB_LEN,
@@ -200,88 +258,246 @@ retry: {
         out_flatterned.w * out_flatterned.h * out_flatterned.c);
     for (int i = 0; i < EMB_LEN; i++) {
         out[i] = out_flatterned[i];
-        if (i < 10) {
-            eapp_print("THE EMB[%d] is %d", i, (int)(out[i] * 1000));
-        }
     }
-    eapp_print("DONE\n");
-
-    /* return EMB_LEN * sizeof(float); */
-    return seal_data_inplace((char *)res, EMBEDDING_SIZE,
-                             EMB_LEN * sizeof(float));
 }
 
-float calculate_distance(in_char emb1[EMBEDDING_SIZE],
-                         in_char emb2[EMBEDDING_SIZE])
+#if EMBEDDING_MODEL_INT8 && INT8_DRIFT_REPORT
+// fp32 reference net, on the default allocators so that it does not disturb
+// the memory plan of the int8 one
+static ncnn::Net *g_ref_net = nullptr;
+static float g_max_drift = 0.f;
+
+// print the L2 distance and cosine similarity between the int8 embedding and
+// the fp32 one. the distance is on the scale of THRESHOLD
+static void report_drift(in_char img[IMG_SIZE], const float emb[EMB_LEN])
 {
-    eapp_print("CALCULATING DISTANCE\n");
-    int emb_len1 = unseal_data_inplace(emb1, EMBEDDING_SIZE);
-    int emb_len2 = unseal_data_inplace(emb2, EMBEDDING_SIZE);
+    if (!g_ref_net) g_ref_net = load_net(FP32_MODEL);
 
-    TEE_ASSERT(emb_len1 == emb_len2, "EMB1 LEN: %d, EMB2 LEN: %d\n", emb_len1,
-               emb_len2);
+    float ref[EMB_LEN];
+    forward(g_ref_net, FP32_MODEL, img, ref);
 
-    // emb_len1 /= sizeof(float);
+    float dist = 0.f, dot = 0.f, norm = 0.f, ref_norm = 0.f;
+    for (int i = 0; i < EMB_LEN; i++) {
+        float d = emb[i] - ref[i];
+        dist += d * d;
+        dot += emb[i] * ref[i];
+        norm += emb[i] * emb[i];
+        ref_norm += ref[i] * ref[i];
+    }
+    dist = sqrtf(dist);
+    float cos = 0.f;
+    if (norm > 0.f && ref_norm > 0.f) cos = dot / sqrtf(norm * ref_norm);
+    if (dist > g_max_drift) g_max_drift = dist;
+    LOG_INFO("INT8 DRIFT: L2 %d/1000 (MAX %d/1000), COS %d/1000\n",
+             (int)(dist * 1000), (int)(g_max_drift * 1000), (int)(cos * 1000));
+}
+#endif
 
-    float *f1 = (float *)emb1;
-    float *f2 = (float *)emb2;
+// the gallery file, its data key is unsealed by the first access
+static GalleryStore g_store(EMB_LEN);
 
-    float sum = 0.f;
-    for (int i = 0; i < EMB_LEN; i++) {
-        float d = f1[i] - f2[i];
-        sum += d * d;
+// decrypted gallery, loaded by the first verification. every ecall starts
+// with refresh(), other instances of this enclave may have written the store
+static Gallery g_gallery(GALLERY_METRIC, GALLERY_IVF_NPROBE,
+                         GALLERY_IVF_TRAIN_SIZE, GALLERY_STORAGE,
+                         GALLERY_RERANK_K, GALLERY_PQ_M,
+                         GALLERY_SEALED_CHUNKS ? &g_store : nullptr);
+
+// run MobileFaceNet on img, the raw embedding is written to out
+static void extract_embedding(in_char img[IMG_SIZE], float out[EMB_LEN])
+{
+    const ncnn::Net *net = get_net();
+    if (g_arena) g_arena->begin_inference();
+    if (g_planner) g_planner->begin_inference();
+
+    forward(net, MODEL, img, out);
+    for (int i = 0; i < 10; i++) {
+        LOG_DEBUG("THE EMB[%d] is %d\n", i, (int)(out[i] * 1000));
     }
+    if (g_planner) {
+        bool was_planned = g_planner->planned();
+        g_planner->end_inference();
+        if (!was_planned && g_planner->planned()) {
+            LOG_INFO("MEMORY PLAN: %d BLOCKS, ARENA %d KB, PEAK LIVE %d KB\n",
+                     g_planner->num_blocks(),
+                     (int)(g_planner->arena_size() / 1024),
+                     (int)(g_planner->peak_live() / 1024));
+        }
+    }
+    if (g_arena) {
+        const ArenaStats &stats = g_arena->stats();
+        LOG_DEBUG("ARENA HWM: %d KB, PEAK IN USE: %d KB, FRAG: %d%%\n",
+                  (int)(stats.high_water_mark / 1024),
+                  (int)(stats.peak_in_use / 1024),
+                  (int)(g_arena->fragmentation() * 100));
+    }
+#if EMBEDDING_MODEL_INT8 && INT8_DRIFT_REPORT
+    report_drift(img, out);
+#endif
+    LOG_DEBUG("DONE\n");
+}
+
+// seal emb into res so that it can be stored outside of the enclave
+static int seal_embedding(const float emb[EMB_LEN], out_char res[EMBEDDING_SIZE])
+{
+    PROFILE_SCOPE(PROF_SEAL, EMB_LEN * sizeof(float));
+    return seal_into(emb, EMB_LEN * sizeof(float), res, EMBEDDING_SIZE);
+}
 
-    return sum;
+int embedding(in_char img[IMG_SIZE], out_char res[EMBEDDING_SIZE])
+{
+    float emb[EMB_LEN];
+    extract_embedding(img, emb);
+    /* return EMB_LEN * sizeof(float); */
+    return seal_embedding(emb, res);
 }
 
 int img_recorder(in_char arr[IMG_SIZE], int id)
 {
+    LogScope log_scope;
+    PROFILE_REQUEST(REQ_RECORD);
+    g_gallery.refresh();
+    float raw_emb[EMB_LEN];
+    extract_embedding(arr, raw_emb);
+#if GALLERY_SEALED_CHUNKS
+    if (!g_store.put(id, raw_emb) || !g_store.flush()) return -1;
+    if (g_gallery.loaded()) g_gallery.put(id, raw_emb);
+    return g_store.record_size();
+#else
     char emb[EMBEDDING_SIZE];
-    int sealed_data_len = embedding(arr, emb);
+    int sealed_data_len = seal_embedding(raw_emb, emb);
+    if (g_gallery.loaded()) g_gallery.put(id, raw_emb);
     // the embedding is sealed and can be stored safely.
-    eapp_print("SEALED_LEN: %d, BUF_LEN: %d\n", sealed_data_len, EMBEDDING_SIZE);
+    LOG_DEBUG("SEALED_LEN: %d, BUF_LEN: %d\n", sealed_data_len,
+              (int)EMBEDDING_SIZE);
 
     std::string filename = "emb" + std::to_string(id) + ".bin";
-    eapp_print("FILENAME: %s\n", filename.c_str());
+    LOG_DEBUG("FILENAME: %s\n", filename.c_str());
 
     write_file((char *)filename.c_str(), (int)filename.size() + 1, emb,
                sealed_data_len);
     // std::ofstream out(filename, std::ios::binary);
     // out.write(emb, sealed_data_len);
     return sealed_data_len;
+#endif
+}
+
+int img_recorder_batch(in_char *imgs, int imgs_len, in_char *ids, int ids_len,
+                       out_char *status, int status_len)
+{
+    LogScope log_scope;
+    PROFILE_REQUEST(REQ_RECORD_BATCH);
+    g_gallery.refresh();
+    int cnt = ids_len / (int)sizeof(int);
+    if (cnt <= 0 || cnt > MAX_BATCH_CNT || imgs_len < cnt * IMG_SIZE ||
+        status_len < cnt * (int)sizeof(int)) {
+        LOG_WARN("INVALID BATCH: %d FACES\n", cnt);
+        return -1;
+    }
+
+#if GALLERY_SEALED_CHUNKS
+    // every chunk the batch touches is encrypted and written once by flush()
+    std::vector<float> raw_embs(cnt * EMB_LEN);
+    std::vector<int> stored(cnt, -1);
+    int recorded = 0;
+    for (int i = 0; i < cnt; i++) {
+        int id;
+        memcpy(&id, ids + i * sizeof(int), sizeof(int));
+        extract_embedding(imgs + i * IMG_SIZE, raw_embs.data() + i * EMB_LEN);
+        if (g_store.put(id, raw_embs.data() + i * EMB_LEN)) {
+            stored[i] = id;
+            recorded++;
+        }
+    }
+    if (recorded > 0 && !g_store.flush()) recorded = 0;
+
+    for (int i = 0; i < cnt; i++) {
+        int len = recorded > 0 && stored[i] >= 0 ? g_store.record_size() : -1;
+        if (len > 0 && g_gallery.loaded()) {
+            g_gallery.put(stored[i], raw_embs.data() + i * EMB_LEN);
+        }
+        memcpy(status + i * sizeof(int), &len, sizeof(int));
+    }
+    LOG_INFO("BATCH RECORDED: %d/%d\n", recorded, cnt);
+    return recorded;
+#else
+    // the net stays warm across the whole batch, and all sealed records leave
+    // the enclave in a single ocall. records are packed at EMBEDDING_SIZE
+    // strides, the seal header carries the real length.
+    std::vector<char> embs(cnt * EMBEDDING_SIZE, 0);
+    std::vector<int> recorded_ids;
+    recorded_ids.reserve(cnt);
+
+    for (int i = 0; i < cnt; i++) {
+        int id;
+        memcpy(&id, ids + i * sizeof(int), sizeof(int));
+
+        float raw_emb[EMB_LEN];
+        char *emb = embs.data() + recorded_ids.size() * EMBEDDING_SIZE;
+        extract_embedding(imgs + i * IMG_SIZE, raw_emb);
+        int sealed_data_len = seal_embedding(raw_emb, emb);
+        if (sealed_data_len <= 0) {
+            memset(emb, 0, EMBEDDING_SIZE);
+            sealed_data_len = -1;
+        }
+        else {
+            recorded_ids.push_back(id);
+            if (g_gallery.loaded()) g_gallery.put(id, raw_emb);
+        }
+        memcpy(status + i * sizeof(int), &sealed_data_len, sizeof(int));
+    }
+    LOG_INFO("BATCH RECORDED: %d/%d\n", (int)recorded_ids.size(), cnt);
+
+    if (!recorded_ids.empty()) {
+        write_files((char *)recorded_ids.data(),
+                    (int)(recorded_ids.size() * sizeof(int)), embs.data(),
+                    (int)(recorded_ids.size() * EMBEDDING_SIZE));
+    }
+    return (int)recorded_ids.size();
+#endif
+}
+
+int pq_train(int iters)
+{
+    LogScope log_scope;
+    PROFILE_REQUEST(REQ_PQ_TRAIN);
+    g_gallery.refresh();
+    if (iters <= 0) return -1;
+    return g_gallery.train_pq(iters);
 }
 
 int img_verifier(in_char arr[IMG_SIZE])
 {
-    char recorded_face_emb[EMBEDDING_SIZE];
-    char in_face_emb[EMBEDDING_SIZE];
-    char in_face_emb_raw[EMBEDDING_SIZE];
+    LogScope log_scope;
+    PROFILE_REQUEST(REQ_VERIFY);
+    g_gallery.refresh();
+    float in_face_emb[EMB_LEN];
+    extract_embedding(arr, in_face_emb);
 
-    int sealed_data_len = embedding(arr, in_face_emb);
     float min_dist = INF;
-    int min_dist_id = -1;
-
-    int emb_ids[MAX_EMB_CNT];
-    eapp_print("BEGIN GET EMBEDDINGS\n");
-    int emb_cnt = get_emb_list((char *)emb_ids);
-    eapp_print("EMB COUNT: %d\n", emb_cnt);
-    for (int i = 0; i < emb_cnt; i++) {
-        int emb_id = emb_ids[i];
-        std::string filename = "emb" + std::to_string(emb_id) + ".bin";
-        eapp_print("READ FILE %s\n", filename.c_str());
-        read_file((char *)filename.c_str(), (int)filename.size(),
-                  recorded_face_emb, EMBEDDING_SIZE);
-        eapp_print("READED FILE %s\n", filename.c_str());
-
-        memcpy(in_face_emb_raw, in_face_emb, EMBEDDING_SIZE);
-        float dist = calculate_distance(recorded_face_emb, in_face_emb_raw);
-        eapp_print("DISTANCE WITH PERSON%d: %d\n", emb_id, (int)dist);
-
-        if (dist < min_dist) {
-            min_dist = dist;
-            min_dist_id = emb_id;
-        }
+#if GALLERY_STREAMING
+    int top_ids[GALLERY_STREAM_TOP_K];
+    float top_dists[GALLERY_STREAM_TOP_K];
+    int found = g_gallery.scan_nearest(in_face_emb, GALLERY_STREAM_TOP_K,
+                                       top_ids, top_dists);
+    for (int i = 0; i < found; i++) {
+        LOG_DEBUG("TOP %d: PERSON%d, DISTANCE: %d\n", i, top_ids[i],
+                  (int)top_dists[i]);
+    }
+    int min_dist_id = found > 0 ? top_ids[0] : -1;
+    if (found > 0) min_dist = top_dists[0];
+#else
+    // the stored records are read and unsealed only once per enclave, every
+    // later verification is an in-memory scan
+    if (!g_gallery.loaded()) g_gallery.load();
+    LOG_INFO("EMB COUNT: %d, DISTANCE KERNEL: %s\n", g_gallery.size(),
+             distance_isa());
+
+    int min_dist_id = g_gallery.nearest(in_face_emb, &min_dist);
+#endif
+    if (min_dist_id >= 0) {
+        LOG_INFO("NEAREST PERSON%d, DISTANCE: %d\n", min_dist_id,
+                 (int)min_dist);
     }
     // for (const auto &e : std::filesystem::directory_iterator(".")) {
     //     const auto &path = e.path();
@@ -309,7 +525,10 @@ int img_verifier(in_char arr[IMG_SIZE])
     //     }
     // }
 
-    if (min_dist < THRESHOLD * THRESHOLD) {
+    const float threshold = g_gallery.metric() == DISTANCE_COSINE
+                                ? COSINE_THRESHOLD
+                                : THRESHOLD * THRESHOLD;
+    if (min_dist < threshold) {
         return min_dist_id;
     }
     return -1;
@@ -0,0 +1,44 @@
+#include "enclave_log.h"
+
+#include "../insecure/file.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+char g_buf[LOG_BUFFER_SIZE];
+int g_len = 0;
+int g_level = ENCLAVE_LOG_LEVEL;
+
+}  // namespace
+
+void log_set_level(int level) { g_level = level; }
+
+int log_level() { return g_level; }
+
+void log_write(int level, const char *fmt, ...)
+{
+    char line[512];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len < 0) return;
+    if (len >= (int)sizeof(line)) len = (int)sizeof(line) - 1;
+
+    if (g_len + len > LOG_BUFFER_SIZE) log_flush();
+    memcpy(g_buf + g_len, line, len);
+    g_len += len;
+
+    // an error may be the last thing the enclave gets to say
+    if (level == LOG_LEVEL_ERROR) log_flush();
+}
+
+void log_flush()
+{
+    if (g_len == 0) return;
+    write_log(g_buf, g_len);
+    g_len = 0;
+}
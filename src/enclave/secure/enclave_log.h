@@ -0,0 +1,50 @@
+#pragma once
+
+// Buffered enclave logging.
+//
+// eapp_print leaves the enclave on every call. Messages logged through the
+// macros below are formatted into an in-enclave buffer instead, which is
+// handed to the host in a single write_log ocall when the ecall returns
+// (LogScope), when it is full, or right away for errors.
+//
+// Messages above ENCLAVE_LOG_LEVEL are compiled out, log_set_level() lowers the
+// level further at runtime.
+
+enum LogLevel
+{
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+#define ENCLAVE_LOG_LEVEL LOG_LEVEL_INFO
+
+// bytes buffered before a flush
+#define LOG_BUFFER_SIZE 4096
+
+void log_set_level(int level);
+int log_level();
+
+void log_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void log_flush();
+
+// flushes the buffered messages when the ecall it is declared in returns
+class LogScope
+{
+   public:
+    LogScope() {}
+    ~LogScope() { log_flush(); }
+};
+
+#define ENCLAVE_LOG(level, ...)                                        \
+    do {                                                               \
+        if ((level) <= ENCLAVE_LOG_LEVEL && (level) <= log_level())    \
+            log_write(level, __VA_ARGS__);                             \
+    } while (0)
+
+#define LOG_ERROR(...) ENCLAVE_LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) ENCLAVE_LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) ENCLAVE_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) ENCLAVE_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
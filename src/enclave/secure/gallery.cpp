@@ -0,0 +1,474 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "distributed_face_recognition_t.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "gallery.h"
+
+#include "embedding.h"
+#include "enclave_log.h"
+
+#include "../insecure/file.h"
+#include "profiler.h"
+#include "sealing.h"
+#include <TEE-Capability/common.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+namespace {
+
+void normalize(float *v, int dim)
+{
+    float norm = 0.f;
+    for (int i = 0; i < dim; i++) norm += v[i] * v[i];
+    norm = sqrtf(norm);
+    if (norm == 0.f) return;
+    for (int i = 0; i < dim; i++) v[i] /= norm;
+}
+
+const char PQ_CODEBOOK_FILE[] = "pq_codebook.bin";
+
+// vectors the product quantizer is trained on at most
+const int PQ_MAX_TRAIN = 64 * PqCodec::PQ_KSUB;
+
+// bytes of sealed records fetched per read_records ocall, they pass through
+// the untrusted shared memory
+const int RECORD_BATCH_BYTES = 256 * 1024;
+// ids fetched per list_records ocall
+const int RECORD_PAGE_IDS = 4096;
+
+struct StrideFilter
+{
+    void (*fn)(int id, const float *emb, void *ctx);
+    void *ctx;
+    int stride;
+    int seen;
+    int calls;
+};
+
+void stride_filter(int id, const float *emb, void *ctx)
+{
+    StrideFilter *filter = (StrideFilter *)ctx;
+    if (filter->seen++ % filter->stride != 0) return;
+    filter->fn(id, emb, filter->ctx);
+    filter->calls++;
+}
+
+struct PqSamples
+{
+    int dim;
+    bool normalize;
+    std::vector<float> data;
+    int n;
+};
+
+void add_pq_sample(int, const float *emb, void *ctx)
+{
+    PqSamples *samples = (PqSamples *)ctx;
+    samples->data.insert(samples->data.end(), emb, emb + samples->dim);
+    if (samples->normalize) {
+        normalize(samples->data.data() + (size_t)samples->n * samples->dim,
+                  samples->dim);
+    }
+    samples->n++;
+}
+
+// running top-k of the records streamed by scan_nearest, which are
+// gathered into DIST_BLOCK-row blocks for the distance kernels
+struct StreamScorer
+{
+    int dim;
+    DistanceMetric metric;
+    const float *probe;
+    std::vector<float> block;
+    int block_ids[DIST_BLOCK];
+    int lanes;
+    int k;
+    int cnt;
+    int *ids;
+    float *dists;
+
+    void score()
+    {
+        float out[DIST_BLOCK];
+        if (metric == DISTANCE_COSINE) {
+            dot_block(probe, block.data(), dim, out);
+        }
+        else {
+            l2_block(probe, block.data(), dim, out);
+        }
+        for (int r = 0; r < lanes; r++) {
+            float dist = metric == DISTANCE_COSINE ? 1.f - out[r] : out[r];
+            push_top_k(k, cnt, ids, dists, block_ids[r], dist);
+        }
+        lanes = 0;
+    }
+};
+
+void put_record(int id, const float *emb, void *store)
+{
+    ((GalleryStore *)store)->put(id, emb);
+}
+
+void score_record(int id, const float *emb, void *ctx)
+{
+    StreamScorer *scorer = (StreamScorer *)ctx;
+    const int dim = scorer->dim;
+    float norm = 1.f;
+    if (scorer->metric == DISTANCE_COSINE) {
+        float sum = 0.f;
+        for (int d = 0; d < dim; d++) sum += emb[d] * emb[d];
+        norm = sum > 0.f ? 1.f / sqrtf(sum) : 0.f;
+    }
+
+    float *block = scorer->block.data();
+    const int r = scorer->lanes;
+    for (int d = 0; d < dim; d++) block[d * DIST_BLOCK + r] = emb[d] * norm;
+    scorer->block_ids[r] = id;
+    if (++scorer->lanes == DIST_BLOCK) scorer->score();
+}
+
+}  // namespace
+
+Gallery::Gallery(DistanceMetric metric, int nprobe, int train_size,
+                 VectorStorage storage, int rerank_k, int pq_m,
+                 GalleryStore *store)
+    : m_dim(EMB_LEN),
+      m_metric(metric),
+      m_nprobe(nprobe),
+      m_train_size(train_size),
+      m_trained_size(0),
+      m_rerank_k(rerank_k),
+      m_loaded(false),
+      m_storage(storage),
+      m_store(store),
+      m_codec(EMB_LEN, pq_m),
+      m_index(EMB_LEN, metric, storage, &m_codec)
+{
+}
+
+bool Gallery::read_record(int id, float *emb) const
+{
+    if (m_store) return m_store->get(id, emb);
+    return read_sealed_record(id, emb);
+}
+
+bool Gallery::read_sealed_record(int id, float *emb) const
+{
+    std::string filename = "emb" + std::to_string(id) + ".bin";
+    char record[EMBEDDING_SIZE];
+    read_file((char *)filename.c_str(), (int)filename.size(), record,
+              EMBEDDING_SIZE);
+
+    int emb_len;
+    {
+        PROFILE_SCOPE(PROF_UNSEAL, EMBEDDING_SIZE);
+        emb_len = unseal_into(record, EMBEDDING_SIZE, emb,
+                              m_dim * (int)sizeof(float));
+    }
+    if (emb_len != m_dim * (int)sizeof(float)) {
+        LOG_WARN("SKIP %s, UNSEALED LEN: %d\n", filename.c_str(), emb_len);
+        return false;
+    }
+    return true;
+}
+
+float Gallery::exact_distance(const float *probe, const float *emb) const
+{
+    float sum = 0.f;
+    for (int i = 0; i < m_dim; i++) {
+        if (m_metric == DISTANCE_COSINE) {
+            sum += probe[i] * emb[i];
+        }
+        else {
+            float d = probe[i] - emb[i];
+            sum += d * d;
+        }
+    }
+    return m_metric == DISTANCE_COSINE ? 1.f - sum : sum;
+}
+
+bool Gallery::load_codebook()
+{
+    const int data_len = (int)m_codec.serialized_size();
+    const int buf_len = data_len + 200;
+    std::vector<char> buf(buf_len), codebook(data_len);
+    read_file((char *)PQ_CODEBOOK_FILE, (int)sizeof(PQ_CODEBOOK_FILE) - 1,
+              buf.data(), buf_len);
+
+    int len;
+    {
+        PROFILE_SCOPE(PROF_UNSEAL, buf_len);
+        len = unseal_into(buf.data(), buf_len, codebook.data(), data_len);
+    }
+    return len > 0 && m_codec.deserialize(codebook.data(), len);
+}
+
+bool Gallery::save_codebook() const
+{
+    const int data_len = (int)m_codec.serialized_size();
+    std::vector<char> codebook(data_len), buf(data_len + 200);
+    m_codec.serialize(codebook.data());
+
+    int sealed_len;
+    {
+        PROFILE_SCOPE(PROF_SEAL, data_len);
+        sealed_len = seal_into(codebook.data(), data_len, buf.data(),
+                               (int)buf.size());
+    }
+    if (sealed_len <= 0) return false;
+    write_file((char *)PQ_CODEBOOK_FILE, (int)sizeof(PQ_CODEBOOK_FILE),
+               buf.data(), sealed_len);
+    return true;
+}
+
+int Gallery::record_count() const
+{
+    if (m_store) return m_store->size();
+
+    // page through the ids, the enclave never holds more than one page
+    std::vector<int> page(RECORD_PAGE_IDS);
+    int cursor = 0, cnt = 0;
+    for (;;) {
+        int n = list_records(cursor, (char *)page.data(),
+                             RECORD_PAGE_IDS * (int)sizeof(int));
+        if (n <= 0) break;
+        n = std::min(n, RECORD_PAGE_IDS);
+        cnt += n;
+        if (page[n - 1] < cursor) break;
+        cursor = page[n - 1] + 1;
+    }
+    return cnt;
+}
+
+int Gallery::for_each_record(void (*fn)(int id, const float *emb, void *ctx),
+                             void *ctx, int stride) const
+{
+    if (m_store) {
+        StrideFilter filter = {fn, ctx, stride, 0, 0};
+        m_store->scan(stride_filter, &filter);
+        return filter.calls;
+    }
+
+    return for_each_sealed_record(fn, ctx, stride);
+}
+
+int Gallery::for_each_sealed_record(
+    void (*fn)(int id, const float *emb, void *ctx), void *ctx,
+    int stride) const
+{
+    const int emb_size = m_dim * (int)sizeof(float);
+    std::vector<char> buf(RECORD_BATCH_BYTES);
+    std::vector<float> emb(m_dim);
+    int cursor = 0, seen = 0, calls = 0;
+    for (;;) {
+        // a failed OCALL must not leave the count of the previous batch
+        int cnt = 0;
+        memcpy(buf.data(), &cnt, sizeof(int));
+        int next = read_records(cursor, buf.data(), (int)buf.size());
+        if (next < 0) {
+            LOG_ERROR("READ RECORDS FAILED AT %d\n", cursor);
+            break;
+        }
+        memcpy(&cnt, buf.data(), sizeof(int));
+        if (cnt <= 0) break;
+        // a batch that does not advance the cursor would be read forever
+        if (next <= cursor) {
+            LOG_ERROR("READ RECORDS STUCK AT %d\n", cursor);
+            break;
+        }
+
+        // the layout comes from the host, every entry is bounds checked
+        int pos = RECORD_ENTRY_ALIGN;
+        for (int i = 0; i < cnt; i++) {
+            int header[2];
+            if (pos + (int)sizeof(header) > (int)buf.size()) break;
+            memcpy(header, buf.data() + pos, sizeof(header));
+            const int id = header[0], len = header[1];
+            if (len < 0 || len > (int)buf.size() - pos - (int)sizeof(header))
+                break;
+            const char *record = buf.data() + pos + sizeof(header);
+            pos += ((int)sizeof(header) + len + RECORD_ENTRY_ALIGN - 1) /
+                   RECORD_ENTRY_ALIGN * RECORD_ENTRY_ALIGN;
+
+            if (seen++ % stride != 0) continue;
+            int emb_len;
+            {
+                PROFILE_SCOPE(PROF_UNSEAL, len);
+                emb_len = unseal_into(record, len, emb.data(), emb_size);
+            }
+            if (emb_len != emb_size) {
+                LOG_WARN("SKIP RECORD %d, UNSEALED LEN: %d\n", id, emb_len);
+                continue;
+            }
+            fn(id, emb.data(), ctx);
+            calls++;
+        }
+        cursor = next;
+    }
+    return calls;
+}
+
+int Gallery::migrate_records()
+{
+    int cnt = for_each_sealed_record(put_record, m_store);
+    if (cnt == 0) return 0;
+    if (!m_store->flush()) return -1;
+    LOG_INFO("MIGRATED %d RECORDS TO %s\n", cnt, GALLERY_FILE);
+    return cnt;
+}
+
+int Gallery::train_pq(int iters)
+{
+    const int stride = std::max(1, record_count() / PQ_MAX_TRAIN);
+
+    PqSamples samples = {m_dim, m_metric == DISTANCE_COSINE, {}, 0};
+    for_each_record(add_pq_sample, &samples, stride);
+    const int n = samples.n;
+    if (n == 0) return -1;
+
+    m_codec.train(samples.data.data(), n, iters);
+    if (!save_codebook()) return -1;
+    LOG_INFO("PQ CODEBOOK: %d SUBSPACES, TRAINED ON %d\n",
+             m_codec.code_size(), n);
+
+    // other enclave instances reload the codebook with the gallery
+    if (m_store) m_store->touch();
+
+    // the resident codes belong to the old codebook
+    if (m_storage == STORAGE_PQ) {
+        m_index = IvfIndex(m_dim, m_metric, m_storage, &m_codec);
+        m_trained_size = 0;
+        m_loaded = false;
+    }
+    return n;
+}
+
+void Gallery::refresh()
+{
+    if (!m_store || !m_store->refresh()) return;
+    if (m_storage == STORAGE_PQ) m_codec = PqCodec(m_dim, m_codec.code_size());
+    m_index = IvfIndex(m_dim, m_metric, m_storage, &m_codec);
+    m_trained_size = 0;
+    m_loaded = false;
+}
+
+int Gallery::load()
+{
+    if (m_storage == STORAGE_PQ && !m_codec.trained() && !load_codebook()) {
+        LOG_WARN("NO PQ CODEBOOK, GALLERY STORED AS INT8\n");
+        m_index = IvfIndex(m_dim, m_metric, STORAGE_INT8);
+    }
+
+    if (m_store && m_store->size() == 0) migrate_records();
+
+    int cnt = for_each_record(insert_record, this);
+    LOG_INFO("LOADED GALLERY: %d ENTRIES\n", cnt);
+
+    m_loaded = true;
+    maybe_train();
+    LOG_INFO("GALLERY MEMORY: %d KB\n", (int)(m_index.memory_bytes() / 1024));
+    return size();
+}
+
+void Gallery::insert_record(int id, const float *emb, void *gallery)
+{
+    ((Gallery *)gallery)->insert(id, emb);
+}
+
+void Gallery::insert(int id, const float *emb)
+{
+    if (m_metric != DISTANCE_COSINE) {
+        m_index.add(id, emb);
+        return;
+    }
+
+    std::vector<float> v(emb, emb + m_dim);
+    normalize(v.data(), m_dim);
+    m_index.add(id, v.data());
+}
+
+void Gallery::put(int id, const float *emb)
+{
+    insert(id, emb);
+    maybe_train();
+}
+
+void Gallery::maybe_train()
+{
+    if (m_train_size <= 0 || size() < m_train_size) return;
+    if (m_trained_size && size() < 4 * m_trained_size) return;
+
+    const int nlist = std::max(1, (int)sqrtf((float)size()));
+    m_index.train(nlist, 10, 64 * nlist);
+    m_trained_size = size();
+    LOG_INFO("GALLERY INDEX: %d ENTRIES IN %d LISTS\n", size(),
+             m_index.nlist());
+}
+
+int Gallery::nearest(const float *probe, float *min_dist) const
+{
+    std::vector<float> p(probe, probe + m_dim);
+    if (m_metric == DISTANCE_COSINE) normalize(p.data(), m_dim);
+
+    if (m_index.storage() == STORAGE_FLOAT32 || m_rerank_k <= 0) {
+        int id = -1;
+        float dist = 0.f;
+        if (!m_index.search(p.data(), m_nprobe, 1, &id, &dist)) return -1;
+
+        if (min_dist) *min_dist = dist;
+        return id;
+    }
+
+    std::vector<int> ids(m_rerank_k);
+    std::vector<float> dists(m_rerank_k);
+    int cnt = m_index.search(p.data(), m_nprobe, m_rerank_k, ids.data(),
+                             dists.data());
+
+    int min_id = -1;
+    float best = 0.f;
+    std::vector<float> emb(m_dim);
+    for (int i = 0; i < cnt; i++) {
+        if (!read_record(ids[i], emb.data())) continue;
+        if (m_metric == DISTANCE_COSINE) normalize(emb.data(), m_dim);
+
+        float dist = exact_distance(p.data(), emb.data());
+        if (min_id < 0 || dist < best) {
+            best = dist;
+            min_id = ids[i];
+        }
+    }
+
+    if (min_dist) *min_dist = best;
+    return min_id;
+}
+
+int Gallery::scan_nearest(const float *probe, int k, int *ids,
+                          float *dists)
+{
+    if (k <= 0) return 0;
+    if (m_store && m_store->size() == 0) migrate_records();
+
+    std::vector<float> p(probe, probe + m_dim);
+    if (m_metric == DISTANCE_COSINE) normalize(p.data(), m_dim);
+
+    StreamScorer scorer = {};
+    scorer.dim = m_dim;
+    scorer.metric = m_metric;
+    scorer.probe = p.data();
+    scorer.block.assign((size_t)m_dim * DIST_BLOCK, 0.f);
+    scorer.k = k;
+    scorer.ids = ids;
+    scorer.dists = dists;
+
+    int scanned = for_each_record(score_record, &scorer);
+    if (scorer.lanes > 0) scorer.score();
+    LOG_DEBUG("STREAMED %d RECORDS\n", scanned);
+    return scorer.cnt;
+}
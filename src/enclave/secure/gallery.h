@@ -0,0 +1,105 @@
+#pragma once
+#include <vector>
+
+#include "distance.h"
+#include "gallery_store.h"
+#include "ivf_index.h"
+#include "pq_codec.h"
+
+// Decrypted face gallery kept resident in the enclave.
+//
+// The sealed records are read and unsealed once by load(), afterwards the
+// embeddings live in an IvfIndex in enclave memory, so a 1:N verification is
+// a vectorized scan without any OCALL or unsealing. Enrollments made through
+// this enclave are inserted with put().
+//
+// Once the gallery holds train_size entries it is clustered into about
+// sqrt(size) inverted lists and searches only scan the nprobe nearest lists.
+// The index is retrained whenever the gallery grows to 4x the size it was
+// last trained at. A train_size of 0 keeps the exhaustive scan.
+//
+// With STORAGE_FP16 or STORAGE_INT8 the resident vectors are kept in reduced
+// precision. A search then collects rerank_k candidates on them and re-ranks
+// those on the full precision embeddings read back from their sealed records,
+// so the enclave never holds the float gallery.
+//
+// STORAGE_PQ needs a codebook trained by train_pq(), which is sealed to
+// PQ_CODEBOOK_FILE and loaded by load(). Without one the gallery falls back
+// to STORAGE_INT8.
+//
+// With a GalleryStore the records are read from its chunked gallery file
+// instead of one sealed emb<id>.bin per face. The first load() of an empty
+// store moves the emb<id>.bin records into it.
+//
+// Records written by another enclave instance after load() are only seen
+// with a GalleryStore, once refresh() finds its generation changed.
+class Gallery
+{
+   public:
+    explicit Gallery(DistanceMetric metric = DISTANCE_L2, int nprobe = 8,
+                     int train_size = 0,
+                     VectorStorage storage = STORAGE_FLOAT32,
+                     int rerank_k = 8, int pq_m = 16,
+                     GalleryStore *store = nullptr);
+
+    bool loaded() const { return m_loaded; }
+    // read and unseal every stored record, returns the number of entries
+    int load();
+    // insert the embedding of id, or replace it if id is already enrolled
+    void put(int id, const float *emb);
+    // unload the gallery and the PQ codebook if another enclave instance
+    // changed the store, the next load() reads them again
+    void refresh();
+
+    int size() const { return m_index.size(); }
+    DistanceMetric metric() const { return m_metric; }
+    const IvfIndex &index() const { return m_index; }
+    // number of lists scanned per search, trades recall for speed
+    void set_nprobe(int nprobe) { m_nprobe = nprobe; }
+
+    // train the product quantizer on the stored records and seal its
+    // codebook, the gallery is reloaded by the next load(). returns the
+    // number of training vectors, -1 on failure
+    int train_pq(int iters);
+
+    // id of the entry nearest to probe under the gallery metric, -1 if empty
+    int nearest(const float *probe, float *min_dist) const;
+
+    // the k stored records nearest to probe in ascending distance, scored
+    // exactly while they stream through the enclave, without load(). for
+    // galleries that do not fit in enclave memory. returns how many were found
+    int scan_nearest(const float *probe, int k, int *ids, float *dists);
+
+   private:
+    // read the stored record of id, false if it is missing or invalid
+    bool read_record(int id, float *emb) const;
+    // unseal emb<id>.bin, false if it is missing or invalid
+    bool read_sealed_record(int id, float *emb) const;
+    int record_count() const;
+    // call fn on every stride-th stored record, returns the number of calls
+    int for_each_record(void (*fn)(int id, const float *emb, void *ctx),
+                        void *ctx, int stride = 1) const;
+    // the same over the emb<id>.bin records, fetched in bulk
+    int for_each_sealed_record(void (*fn)(int id, const float *emb, void *ctx),
+                               void *ctx, int stride = 1) const;
+    int migrate_records();
+    static void insert_record(int id, const float *emb, void *gallery);
+    bool load_codebook();
+    bool save_codebook() const;
+    float exact_distance(const float *probe, const float *emb) const;
+    void insert(int id, const float *emb);
+    void maybe_train();
+
+    int m_dim;
+    DistanceMetric m_metric;
+    int m_nprobe;
+    int m_train_size;
+    int m_trained_size;
+    int m_rerank_k;
+    bool m_loaded;
+    VectorStorage m_storage;
+    GalleryStore *m_store;
+    // declared before m_index, which points to it
+    PqCodec m_codec;
+    IvfIndex m_index;
+};
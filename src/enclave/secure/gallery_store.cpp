@@ -0,0 +1,433 @@
+#include "gallery_store.h"
+
+#include "enclave_log.h"
+#include "profiler.h"
+#include "sealing.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char FILENAME[] = GALLERY_FILE;
+
+void store32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+int row_id(const char *row)
+{
+    int id;
+    memcpy(&id, row, sizeof(id));
+    return id;
+}
+
+}  // namespace
+
+GalleryStore::GalleryStore(int dim, int chunk_rows)
+    : m_dim(dim),
+      m_chunk_rows(chunk_rows),
+      m_row_size((int)sizeof(int32_t) + dim * (int)sizeof(float)),
+      m_open(false),
+      m_indexed(false),
+      m_header_dirty(false),
+      m_next_row(0),
+      m_prefetch_base(0)
+{
+    memset(m_prefetched, 0, sizeof(m_prefetched));
+    memset(&m_header, 0, sizeof(m_header));
+    memset(m_key, 0, sizeof(m_key));
+}
+
+GalleryStore::~GalleryStore() { memset(m_key, 0, sizeof(m_key)); }
+
+int64_t GalleryStore::chunk_offset(int chunk) const
+{
+    return (int64_t)sizeof(GalleryFileHeader) + (int64_t)chunk * chunk_size();
+}
+
+bool GalleryStore::open(bool create)
+{
+    if (m_open) return true;
+
+    int len = read_file_at((char *)FILENAME, (int)sizeof(FILENAME), 0,
+                           (char *)&m_header, (int)sizeof(m_header));
+    if (len == FILE_NOT_FOUND && !create) {
+        memset(&m_header, 0, sizeof(m_header));
+        return false;
+    }
+    if (len == FILE_NOT_FOUND) {
+        // no gallery yet, start one under a fresh data key. any other
+        // failure must not, the next flush would overwrite the gallery
+        memset(&m_header, 0, sizeof(m_header));
+        m_header.magic = GALLERY_MAGIC;
+        m_header.dim = m_dim;
+        m_header.chunk_rows = m_chunk_rows;
+        if (!random_bytes(m_key, sizeof(m_key))) {
+            LOG_ERROR("GALLERY: NO RANDOM DATA KEY\n");
+            return false;
+        }
+        int sealed_len;
+        {
+            PROFILE_SCOPE(PROF_SEAL, sizeof(m_key));
+            sealed_len = seal_into(m_key, sizeof(m_key), m_header.sealed_key,
+                                   sizeof(m_header.sealed_key));
+        }
+        m_header.sealed_key_len = sealed_len;
+        if (sealed_len <= 0 || !write_header()) {
+            LOG_ERROR("GALLERY: CANNOT CREATE %s\n", FILENAME);
+            return false;
+        }
+
+        m_indexed = true;
+        m_open = true;
+        LOG_INFO("GALLERY: CREATED %s\n", FILENAME);
+        return true;
+    }
+
+    if (len < 0) {
+        LOG_ERROR("GALLERY: CANNOT READ %s\n", FILENAME);
+        return false;
+    }
+    if (len != (int)sizeof(m_header) || m_header.magic != GALLERY_MAGIC ||
+        m_header.dim != (uint32_t)m_dim ||
+        m_header.chunk_rows != (uint32_t)m_chunk_rows ||
+        m_header.sealed_key_len > sizeof(m_header.sealed_key)) {
+        LOG_ERROR("GALLERY: BAD HEADER IN %s\n", FILENAME);
+        return false;
+    }
+
+    int key_len;
+    {
+        PROFILE_SCOPE(PROF_UNSEAL, m_header.sealed_key_len);
+        key_len = unseal_into(m_header.sealed_key, m_header.sealed_key_len,
+                              m_key, sizeof(m_key));
+    }
+    if (key_len != (int)sizeof(m_key)) {
+        LOG_ERROR("GALLERY: CANNOT UNSEAL THE DATA KEY\n");
+        return false;
+    }
+
+    m_open = true;
+    return true;
+}
+
+bool GalleryStore::refresh()
+{
+    GalleryFileHeader header;
+    int len = read_file_at((char *)FILENAME, (int)sizeof(FILENAME), 0,
+                           (char *)&header, (int)sizeof(header));
+    const uint32_t generation =
+        len == (int)sizeof(header) ? header.generation : 0;
+    if (generation == m_header.generation) return false;
+
+    LOG_INFO("GALLERY: GENERATION %u -> %u, RELOADING\n",
+             m_header.generation, generation);
+    m_open = false;
+    m_indexed = false;
+    m_rows.clear();
+    m_next_row = 0;
+    m_dirty.clear();
+    m_header_dirty = false;
+    memset(&m_header, 0, sizeof(m_header));
+    memset(m_key, 0, sizeof(m_key));
+    // until the next open() reads the header again
+    m_header.generation = generation;
+    return true;
+}
+
+bool GalleryStore::write_header()
+{
+    return write_file_at((char *)FILENAME, (int)sizeof(FILENAME), 0,
+                         (char *)&m_header, (int)sizeof(m_header)) ==
+           (int)sizeof(m_header);
+}
+
+void GalleryStore::make_aad(int chunk, uint8_t aad[16]) const
+{
+    store32(aad, m_header.magic);
+    store32(aad + 4, m_header.dim);
+    store32(aad + 8, m_header.chunk_rows);
+    store32(aad + 12, (uint32_t)chunk);
+}
+
+const char *GalleryStore::load_chunk(int chunk)
+{
+    m_buf.resize(chunk_size());
+    int len = read_file_at((char *)FILENAME, (int)sizeof(FILENAME),
+                           chunk_offset(chunk), m_buf.data(),
+                           (int)m_buf.size());
+    if (len != (int)m_buf.size()) return nullptr;
+    return decrypt_chunk(chunk, m_buf.data());
+}
+
+const char *GalleryStore::decrypt_chunk(int chunk, char *data)
+{
+    const int rows_len = m_chunk_rows * m_row_size;
+    uint8_t *nonce = (uint8_t *)data;
+    uint8_t *tag = nonce + AEAD_NONCE_SIZE;
+    uint8_t *rows = tag + AEAD_TAG_SIZE;
+    uint8_t aad[16];
+    make_aad(chunk, aad);
+
+    PROFILE_SCOPE(PROF_DECRYPT, rows_len);
+    if (!aead_decrypt(m_key, nonce, aad, sizeof(aad), rows, rows_len, tag)) {
+        LOG_WARN("GALLERY: CHUNK %d FAILED AUTHENTICATION\n", chunk);
+        return nullptr;
+    }
+    return (const char *)rows;
+}
+
+bool GalleryStore::write_chunk(int chunk, const char *rows)
+{
+    const int rows_len = m_chunk_rows * m_row_size;
+    m_buf.resize(chunk_size());
+    uint8_t *nonce = (uint8_t *)m_buf.data();
+    uint8_t *tag = nonce + AEAD_NONCE_SIZE;
+    uint8_t *data = tag + AEAD_TAG_SIZE;
+
+    // a chunk is rewritten under a new random nonce every time, the chunk
+    // index keeps nonces of different chunks apart
+    store32(nonce, (uint32_t)chunk);
+    if (!random_bytes(nonce + 4, AEAD_NONCE_SIZE - 4)) return false;
+    uint8_t aad[16];
+    make_aad(chunk, aad);
+
+    memcpy(data, rows, rows_len);
+    {
+        PROFILE_SCOPE(PROF_ENCRYPT, rows_len);
+        aead_encrypt(m_key, nonce, aad, sizeof(aad), data, rows_len, tag);
+    }
+    return write_file_at((char *)FILENAME, (int)sizeof(FILENAME),
+                         chunk_offset(chunk), m_buf.data(),
+                         (int)m_buf.size()) == (int)m_buf.size();
+}
+
+void GalleryStore::prefetch_run(int run)
+{
+    const int first = run * GALLERY_STREAM_CHUNKS;
+    const int cnt =
+        std::min(GALLERY_STREAM_CHUNKS, (int)m_header.num_chunks - first);
+    const int slot = run % PREFETCH_SLOTS;
+    m_prefetched[slot] =
+        prefetch_file((char *)FILENAME, (int)sizeof(FILENAME),
+                      chunk_offset(first), cnt * chunk_size(),
+                      m_prefetch_base + slot) == 0;
+}
+
+int GalleryStore::fetch_run(int run, int run_chunks)
+{
+    const int slot = run % PREFETCH_SLOTS;
+    const int len = run_chunks * chunk_size();
+    if (m_prefetched[slot]) {
+        m_prefetched[slot] = false;
+        int got = fetch_prefetched(m_prefetch_base + slot, m_buf.data(), len);
+        if (got == len) return got;
+    }
+    // the host turned the read ahead down, read the run now
+    return read_file_at((char *)FILENAME, (int)sizeof(FILENAME),
+                        chunk_offset(run * GALLERY_STREAM_CHUNKS),
+                        m_buf.data(), len);
+}
+
+int GalleryStore::visit_rows(int chunk, const char *rows,
+                             void (*fn)(int id, const float *emb, void *ctx),
+                             void *ctx)
+{
+    int cnt = 0;
+    for (int i = 0; i < m_chunk_rows; i++) {
+        const char *row = rows + i * m_row_size;
+        int id = row_id(row);
+        if (id < 0) continue;
+
+        if (!m_indexed) {
+            int r = chunk * m_chunk_rows + i;
+            m_rows[id] = r;
+            if (r >= m_next_row) m_next_row = r + 1;
+        }
+        if (fn) fn(id, (const float *)(row + sizeof(int32_t)), ctx);
+        cnt++;
+    }
+    return cnt;
+}
+
+int GalleryStore::scan(void (*fn)(int id, const float *emb, void *ctx),
+                       void *ctx)
+{
+    if (!open()) return 0;
+
+    const int num_chunks = (int)m_header.num_chunks;
+    const int num_runs =
+        (num_chunks + GALLERY_STREAM_CHUNKS - 1) / GALLERY_STREAM_CHUNKS;
+    uint32_t base = 0;
+    const bool prefetch = random_bytes(&base, sizeof(base));
+    m_prefetch_base = (int)(base & 0x3fffffff);
+    for (int run = 0; prefetch && run < num_runs && run < PREFETCH_SLOTS;
+         run++) {
+        prefetch_run(run);
+    }
+
+    int cnt = 0;
+    std::vector<int> retry;
+    m_buf.resize(GALLERY_STREAM_CHUNKS * chunk_size());
+    for (int run = 0; run < num_runs; run++) {
+        const int first = run * GALLERY_STREAM_CHUNKS;
+        const int run_chunks =
+            std::min(GALLERY_STREAM_CHUNKS, num_chunks - first);
+        int len = fetch_run(run, run_chunks);
+        // the slot is free again, keep the host reading ahead while this
+        // run is decrypted
+        if (prefetch && run + PREFETCH_SLOTS < num_runs) {
+            prefetch_run(run + PREFETCH_SLOTS);
+        }
+
+        for (int i = 0; i < run_chunks; i++) {
+            const int chunk = first + i;
+            auto dirty = m_dirty.find(chunk);
+            const char *rows = nullptr;
+            if (dirty != m_dirty.end()) {
+                rows = dirty->second.data();
+            }
+            else if (len >= (i + 1) * chunk_size()) {
+                rows = decrypt_chunk(chunk, m_buf.data() + i * chunk_size());
+            }
+
+            if (!rows) {
+                // another instance may have been writing the chunk, it is
+                // read once more after the rest of the file
+                retry.push_back(chunk);
+                continue;
+            }
+            cnt += visit_rows(chunk, rows, fn, ctx);
+        }
+    }
+
+    for (int chunk : retry) {
+        const char *rows = load_chunk(chunk);
+        if (!rows) {
+            LOG_WARN("GALLERY: SKIPPED CHUNK %d\n", chunk);
+            // never append into a chunk that cannot be read back
+            if (!m_indexed) {
+                m_next_row = std::max(m_next_row, (chunk + 1) * m_chunk_rows);
+            }
+            continue;
+        }
+        cnt += visit_rows(chunk, rows, fn, ctx);
+    }
+    m_indexed = true;
+    return cnt;
+}
+
+void GalleryStore::index_rows()
+{
+    if (!m_indexed) scan(nullptr, nullptr);
+}
+
+int GalleryStore::size()
+{
+    if (!open()) return 0;
+    index_rows();
+    return (int)m_rows.size();
+}
+
+bool GalleryStore::get(int id, float *emb)
+{
+    if (!open()) return false;
+    index_rows();
+    auto it = m_rows.find(id);
+    if (it == m_rows.end()) return false;
+
+    const int chunk = it->second / m_chunk_rows;
+    auto dirty = m_dirty.find(chunk);
+    const char *rows =
+        dirty != m_dirty.end() ? dirty->second.data() : load_chunk(chunk);
+    // read again once if another instance was writing the chunk
+    if (!rows) rows = load_chunk(chunk);
+    if (!rows) return false;
+
+    const char *row = rows + (it->second % m_chunk_rows) * m_row_size;
+    memcpy(emb, row + sizeof(int32_t), m_dim * sizeof(float));
+    return true;
+}
+
+bool GalleryStore::put(int id, const float *emb)
+{
+    if (id < 0 || !open(true)) return false;
+    index_rows();
+
+    auto it = m_rows.find(id);
+    const int r = it != m_rows.end() ? it->second : m_next_row;
+    const int chunk = r / m_chunk_rows;
+
+    auto dirty = m_dirty.find(chunk);
+    if (dirty == m_dirty.end()) {
+        std::vector<char> rows(m_chunk_rows * m_row_size);
+        const char *stored = chunk < (int)m_header.num_chunks
+                                 ? load_chunk(chunk)
+                                 : nullptr;
+        if (stored) {
+            memcpy(rows.data(), stored, rows.size());
+        }
+        else if (chunk < (int)m_header.num_chunks) {
+            return false;
+        }
+        else {
+            for (int i = 0; i < m_chunk_rows; i++) {
+                const int32_t unused = -1;
+                memcpy(rows.data() + i * m_row_size, &unused, sizeof(unused));
+            }
+        }
+        dirty = m_dirty.emplace(chunk, std::move(rows)).first;
+    }
+
+    char *row = dirty->second.data() + (r % m_chunk_rows) * m_row_size;
+    const int32_t row_id = id;
+    memcpy(row, &row_id, sizeof(row_id));
+    memcpy(row + sizeof(int32_t), emb, m_dim * sizeof(float));
+
+    if (it == m_rows.end()) {
+        m_rows[id] = r;
+        m_next_row = r + 1;
+    }
+    return true;
+}
+
+bool GalleryStore::flush()
+{
+    if (m_dirty.empty() && !m_header_dirty) return true;
+
+    bool ok = true;
+    uint32_t num_chunks = m_header.num_chunks;
+    auto dirty = m_dirty.begin();
+    while (dirty != m_dirty.end()) {
+        const uint32_t chunk = (uint32_t)dirty->first;
+        // the header cannot count a chunk past one that failed, keep it
+        // staged for the next flush
+        if (chunk > num_chunks) {
+            ++dirty;
+            continue;
+        }
+        if (!write_chunk(chunk, dirty->second.data())) {
+            // stays staged, so m_rows and m_next_row still hold
+            LOG_ERROR("GALLERY: CANNOT WRITE CHUNK %u\n", chunk);
+            ok = false;
+            ++dirty;
+            continue;
+        }
+        if (chunk == num_chunks) num_chunks++;
+        dirty = m_dirty.erase(dirty);
+    }
+
+    // the header goes last, so that it never counts a chunk not yet written
+    m_header.num_chunks = num_chunks;
+    m_header.generation++;
+    m_header_dirty = !write_header();
+    if (m_header_dirty) LOG_ERROR("GALLERY: CANNOT WRITE THE HEADER\n");
+    return ok && !m_header_dirty;
+}
+
+bool GalleryStore::touch()
+{
+    if (!open()) return false;
+    m_header.generation++;
+    m_header_dirty = !write_header();
+    return !m_header_dirty;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "../insecure/file.h"
+#include "aead.h"
+
+// Sealed gallery file with envelope encryption.
+//
+// Instead of one platform sealed emb<id>.bin per face, all embeddings live
+// in GALLERY_FILE, grouped into chunks of chunk_rows records. Every chunk is
+// encrypted and authenticated with ChaCha20-Poly1305 under a random gallery
+// data key, and only that 32 byte key goes through the platform seal, once
+// when the file is created. Opening the gallery unseals the key once per
+// enclave, reading it back is symmetric decryption of whole chunks.
+//
+// Layout: a GalleryFileHeader, then num_chunks chunks of chunk_size() bytes,
+// each a random nonce, the tag and the encrypted rows. A row is the int32 id
+// (-1 for an unused row) followed by dim floats. The header fields and the
+// chunk index are authenticated with each chunk, so chunks cannot be moved
+// around or spliced into a gallery of another shape. Replaying an older
+// version of a whole chunk or file is not detected.
+//
+// Every flush bumps the generation in the header. Other enclave instances
+// sharing the file call refresh() before they use it and drop what they have
+// cached of an older generation. Only one instance may write at a time.
+#define GALLERY_FILE "gallery.bin"
+// bumped with every change of the file layout, older files are rejected
+#define GALLERY_MAGIC 0x324c4147  // "GAL2"
+// records per chunk, the unit of encryption and of every read and write
+#define GALLERY_CHUNK_ROWS 64
+// room reserved in the header for the sealed data key
+#define GALLERY_SEALED_KEY_SPACE 256
+// chunks scan() fetches per ocall. up to PREFETCH_SLOTS such runs are read
+// ahead by the host while the enclave decrypts the current one, so the
+// enclave never holds more than one run of the gallery
+#define GALLERY_STREAM_CHUNKS 8
+
+struct GalleryFileHeader
+{
+    uint32_t magic;
+    uint32_t dim;
+    uint32_t chunk_rows;
+    uint32_t num_chunks;
+    // bumped by every flush
+    uint32_t generation;
+    uint32_t sealed_key_len;
+    char sealed_key[GALLERY_SEALED_KEY_SPACE];
+};
+
+class GalleryStore
+{
+   public:
+    explicit GalleryStore(int dim, int chunk_rows = GALLERY_CHUNK_ROWS);
+    ~GalleryStore();
+
+    // read the header and unseal the data key. a missing file is created
+    // empty under a fresh key if create is set, so that only the writing
+    // instance ever picks a key. false if there is no gallery, or it is
+    // corrupt or was sealed by another enclave
+    bool open(bool create = false);
+    bool is_open() const { return m_open; }
+    // drop the header, key and index if another instance flushed the file
+    // since they were read, returns true if it did. staged puts are lost
+    bool refresh();
+
+    // number of records, the first call scans the whole file
+    int size();
+    // bytes one record takes in the file
+    int record_size() const { return m_row_size; }
+    // bytes one chunk takes in the file
+    int chunk_size() const
+    {
+        return AEAD_NONCE_SIZE + AEAD_TAG_SIZE + m_chunk_rows * m_row_size;
+    }
+
+    // stream the file through the enclave and call fn for every record,
+    // returns the number of records. a chunk that fails to authenticate, as
+    // one torn by a write of another instance, is read once more at the end
+    // and skipped if it fails again. fn must not call back into the store
+    int scan(void (*fn)(int id, const float *emb, void *ctx), void *ctx);
+
+    // copy the embedding of id to emb, false if it is not stored
+    bool get(int id, float *emb);
+    // stage the embedding of id, replacing a stored one. nothing is written
+    // before flush()
+    bool put(int id, const float *emb);
+    // encrypt and write the chunks changed by put(), then the header. false
+    // if any write failed, the chunks not written stay staged for the next
+    // flush
+    bool flush();
+    // bump the generation without changing any record, for state derived
+    // from the gallery such as the PQ codebook
+    bool touch();
+
+   private:
+    int64_t chunk_offset(int chunk) const;
+    // read and decrypt chunk into m_buf, returns its rows or nullptr
+    const char *load_chunk(int chunk);
+    // decrypt chunk as stored at data in place, returns its rows or nullptr
+    const char *decrypt_chunk(int chunk, char *data);
+    // ask the host to read the run-th GALLERY_STREAM_CHUNKS chunks
+    void prefetch_run(int run);
+    // the run-th chunks into m_buf, prefetched if the host took the request
+    int fetch_run(int run, int run_chunks);
+    int visit_rows(int chunk, const char *rows,
+                   void (*fn)(int id, const float *emb, void *ctx), void *ctx);
+    bool write_chunk(int chunk, const char *rows);
+    bool write_header();
+    void make_aad(int chunk, uint8_t aad[16]) const;
+    void index_rows();
+
+    int m_dim;
+    int m_chunk_rows;
+    int m_row_size;
+    bool m_open;
+    bool m_indexed;
+    // the last header write failed, the next flush writes it again
+    bool m_header_dirty;
+    GalleryFileHeader m_header;
+    uint8_t m_key[AEAD_KEY_SIZE];
+    // id to row, filled by the first scan
+    std::unordered_map<int, int> m_rows;
+    // first row put() appends to
+    int m_next_row;
+    // decrypted rows of the chunks changed since the last flush
+    std::map<int, std::vector<char>> m_dirty;
+    // chunks as stored: nonce, tag, encrypted rows
+    std::vector<char> m_buf;
+    // prefetch handles of the current scan are m_prefetch_base plus the slot,
+    // drawn at random so that other enclaves on the host never use them
+    int m_prefetch_base;
+    bool m_prefetched[PREFETCH_SLOTS];
+};
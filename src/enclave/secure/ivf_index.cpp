@@ -0,0 +1,307 @@
+#include "ivf_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "kmeans.h"
+
+IvfIndex::IvfIndex(int dim, DistanceMetric metric, VectorStorage storage,
+                   const PqCodec *codec)
+    : m_dim(dim),
+      m_metric(metric),
+      m_storage(storage),
+      m_codec(codec),
+      m_row_elems(storage == STORAGE_PQ ? codec->code_size() : dim),
+      m_elem_size(storage_elem_size(storage)),
+      m_trained(false),
+      m_lists(1)
+{
+}
+
+size_t IvfIndex::block_bytes() const
+{
+    return (size_t)DIST_BLOCK * m_row_elems * m_elem_size;
+}
+
+size_t IvfIndex::memory_bytes() const
+{
+    size_t bytes = m_centroids.size() * sizeof(float);
+    for (const List &list : m_lists) {
+        bytes += list.ids.size() * sizeof(int) + list.blocks.size() +
+                 (list.scales.size() + list.sqnorms.size()) * sizeof(float);
+    }
+    return bytes;
+}
+
+void IvfIndex::set_row(List &list, int slot, const float *v)
+{
+    uint8_t *block = list.blocks.data() + (size_t)(slot / DIST_BLOCK) * block_bytes();
+    const int lane = slot % DIST_BLOCK;
+
+    if (m_storage == STORAGE_FLOAT32) {
+        float *g = (float *)block;
+        for (int d = 0; d < m_dim; d++) g[d * DIST_BLOCK + lane] = v ? v[d] : 0.f;
+        return;
+    }
+    if (m_storage == STORAGE_PQ) {
+        // codes are kept row by row for the table lookups
+        uint8_t *code = block + (size_t)lane * m_row_elems;
+        if (v)
+            m_codec->encode(v, code);
+        else
+            memset(code, 0, m_row_elems);
+        return;
+    }
+
+    float scale = 0.f, sqnorm = 0.f;
+    if (m_storage == STORAGE_FP16) {
+        uint16_t *g = (uint16_t *)block;
+        for (int d = 0; d < m_dim; d++) {
+            uint16_t h = float_to_half(v ? v[d] : 0.f);
+            float f = half_to_float(h);
+            g[d * DIST_BLOCK + lane] = h;
+            sqnorm += f * f;
+        }
+        scale = 1.f;
+    }
+    else {
+        std::vector<int8_t> q(m_dim, 0);
+        if (v) scale = quantize_s8(v, m_dim, q.data());
+        int8_t *g = (int8_t *)block;
+        for (int d = 0; d < m_dim; d++) {
+            g[d * DIST_BLOCK + lane] = q[d];
+            sqnorm += (float)q[d] * q[d];
+        }
+        sqnorm *= scale * scale;
+    }
+    list.scales[slot] = scale;
+    list.sqnorms[slot] = sqnorm;
+}
+
+void IvfIndex::get_row(const List &list, int slot, float *v) const
+{
+    const uint8_t *block =
+        list.blocks.data() + (size_t)(slot / DIST_BLOCK) * block_bytes();
+    const int lane = slot % DIST_BLOCK;
+
+    if (m_storage == STORAGE_PQ) {
+        m_codec->decode(block + (size_t)lane * m_row_elems, v);
+        return;
+    }
+    for (int d = 0; d < m_dim; d++) {
+        const size_t idx = (size_t)d * DIST_BLOCK + lane;
+        if (m_storage == STORAGE_FP16)
+            v[d] = half_to_float(((const uint16_t *)block)[idx]);
+        else if (m_storage == STORAGE_INT8)
+            v[d] = ((const int8_t *)block)[idx] * list.scales[slot];
+        else
+            v[d] = ((const float *)block)[idx];
+    }
+}
+
+void IvfIndex::move_row(List &list, int from, int to)
+{
+    // copy the stored elements as they are, no requantization
+    const uint8_t *src =
+        list.blocks.data() + (size_t)(from / DIST_BLOCK) * block_bytes();
+    uint8_t *dst = list.blocks.data() + (size_t)(to / DIST_BLOCK) * block_bytes();
+    if (m_storage == STORAGE_PQ) {
+        memcpy(dst + (size_t)(to % DIST_BLOCK) * m_row_elems,
+               src + (size_t)(from % DIST_BLOCK) * m_row_elems, m_row_elems);
+        return;
+    }
+    for (int d = 0; d < m_dim; d++) {
+        memcpy(dst + ((size_t)d * DIST_BLOCK + to % DIST_BLOCK) * m_elem_size,
+               src + ((size_t)d * DIST_BLOCK + from % DIST_BLOCK) * m_elem_size,
+               m_elem_size);
+    }
+    if (has_scales()) {
+        list.scales[to] = list.scales[from];
+        list.sqnorms[to] = list.sqnorms[from];
+    }
+}
+
+void IvfIndex::append(int list_idx, int id, const float *v)
+{
+    List &list = m_lists[list_idx];
+    const int slot = (int)list.ids.size();
+    if (slot % DIST_BLOCK == 0) {
+        list.blocks.resize(list.blocks.size() + block_bytes(), 0);
+        if (has_scales()) {
+            list.scales.resize(slot + DIST_BLOCK, 0.f);
+            list.sqnorms.resize(slot + DIST_BLOCK, 0.f);
+        }
+    }
+    set_row(list, slot, v);
+    list.ids.push_back(id);
+    m_where[id] = {list_idx, slot};
+}
+
+void IvfIndex::remove(int id)
+{
+    auto it = m_where.find(id);
+    if (it == m_where.end()) return;
+
+    List &list = m_lists[it->second.first];
+    const int slot = it->second.second;
+    const int last = (int)list.ids.size() - 1;
+    m_where.erase(it);
+
+    // move the last entry of the list into the hole
+    if (slot != last) {
+        move_row(list, last, slot);
+        list.ids[slot] = list.ids[last];
+        m_where[list.ids[slot]].second = slot;
+    }
+    set_row(list, last, nullptr);
+    list.ids.pop_back();
+    if (last % DIST_BLOCK == 0) {
+        list.blocks.resize(list.blocks.size() - block_bytes());
+        if (has_scales()) {
+            list.scales.resize(last);
+            list.sqnorms.resize(last);
+        }
+    }
+}
+
+void IvfIndex::rank_centroids(const float *v, int n, int *lists) const
+{
+    const int cnt = nlist();
+    std::vector<float> dists(
+        (size_t)(cnt + DIST_BLOCK - 1) / DIST_BLOCK * DIST_BLOCK);
+    block_distances(v, m_centroids.data(), cnt, m_dim, dists.data());
+
+    std::vector<int> order(cnt);
+    for (int i = 0; i < cnt; i++) order[i] = i;
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [&](int a, int b) { return dists[a] < dists[b]; });
+    memcpy(lists, order.data(), n * sizeof(int));
+}
+
+void IvfIndex::add(int id, const float *v)
+{
+    remove(id);
+
+    int list = 0;
+    if (m_trained) rank_centroids(v, 1, &list);
+    append(list, id, v);
+}
+
+void IvfIndex::train(int nlist, int iters, int max_samples)
+{
+    const int n = size();
+    nlist = std::min(nlist, n);
+    if (nlist <= 1) return;
+
+    // evenly strided training sample over all lists
+    const int stride = std::max(1, n / std::max(max_samples, nlist));
+    std::vector<float> samples;
+    int num_samples = 0, seen = 0;
+    for (const List &list : m_lists) {
+        for (int slot = 0; slot < (int)list.ids.size(); slot++, seen++) {
+            if (seen % stride) continue;
+            samples.resize(samples.size() + m_dim);
+            get_row(list, slot, samples.data() + (size_t)num_samples * m_dim);
+            num_samples++;
+        }
+    }
+    nlist = std::min(nlist, num_samples);
+
+    std::vector<float> centroids((size_t)nlist * m_dim);
+    kmeans(samples.data(), num_samples, m_dim, nlist, iters, centroids.data());
+    m_centroids = pack_blocks(centroids.data(), nlist, m_dim);
+    samples.clear();
+    samples.shrink_to_fit();
+
+    // move every entry into its new list, releasing old lists one by one
+    std::vector<List> old_lists(nlist);
+    old_lists.swap(m_lists);
+    m_where.clear();
+    m_trained = true;
+
+    std::vector<float> v(m_dim);
+    for (List &list : old_lists) {
+        for (int slot = 0; slot < (int)list.ids.size(); slot++) {
+            get_row(list, slot, v.data());
+            int target;
+            rank_centroids(v.data(), 1, &target);
+            append(target, list.ids[slot], v.data());
+        }
+        List().ids.swap(list.ids);
+        List().blocks.swap(list.blocks);
+        List().scales.swap(list.scales);
+        List().sqnorms.swap(list.sqnorms);
+    }
+}
+
+void IvfIndex::score_block(const List &list, int base, const float *probe,
+                           float probe_sqnorm, const float *lut,
+                           float *dists) const
+{
+    const uint8_t *block =
+        list.blocks.data() + (size_t)(base / DIST_BLOCK) * block_bytes();
+
+    if (m_storage == STORAGE_PQ) {
+        for (int r = 0; r < DIST_BLOCK; r++) {
+            float score = m_codec->adc(lut, block + (size_t)r * m_row_elems);
+            dists[r] = m_metric == DISTANCE_COSINE ? 1.f - score : score;
+        }
+        return;
+    }
+
+    if (m_storage == STORAGE_FLOAT32) {
+        if (m_metric == DISTANCE_COSINE) {
+            dot_block(probe, (const float *)block, m_dim, dists);
+            for (int r = 0; r < DIST_BLOCK; r++) dists[r] = 1.f - dists[r];
+        }
+        else {
+            l2_block(probe, (const float *)block, m_dim, dists);
+        }
+        return;
+    }
+
+    // |p - s q|^2 = |p|^2 - 2 s p.q + |s q|^2
+    if (m_storage == STORAGE_FP16)
+        dot_block_f16(probe, (const uint16_t *)block, m_dim, dists);
+    else
+        dot_block_s8(probe, (const int8_t *)block, m_dim, dists);
+    for (int r = 0; r < DIST_BLOCK; r++) {
+        const float dot = list.scales[base + r] * dists[r];
+        dists[r] = m_metric == DISTANCE_COSINE
+                       ? 1.f - dot
+                       : probe_sqnorm - 2.f * dot + list.sqnorms[base + r];
+    }
+}
+
+int IvfIndex::search(const float *probe, int nprobe, int k, int *ids,
+                     float *dists) const
+{
+    if (k <= 0 || size() == 0) return 0;
+
+    nprobe = std::max(1, std::min(nprobe, nlist()));
+    std::vector<int> lists(nprobe, 0);
+    if (m_trained) rank_centroids(probe, nprobe, lists.data());
+
+    float probe_sqnorm = 0.f;
+    for (int d = 0; d < m_dim; d++) probe_sqnorm += probe[d] * probe[d];
+
+    std::vector<float> lut;
+    if (m_storage == STORAGE_PQ) {
+        lut.resize((size_t)m_row_elems * PqCodec::PQ_KSUB);
+        m_codec->compute_lut(probe, m_metric, lut.data());
+    }
+
+    int cnt = 0;
+    float scores[DIST_BLOCK];
+    for (int list_idx : lists) {
+        const List &list = m_lists[list_idx];
+        const int len = (int)list.ids.size();
+        for (int base = 0; base < len; base += DIST_BLOCK) {
+            score_block(list, base, probe, probe_sqnorm, lut.data(), scores);
+            const int lanes = std::min(DIST_BLOCK, len - base);
+            for (int r = 0; r < lanes; r++)
+                push_top_k(k, cnt, ids, dists, list.ids[base + r], scores[r]);
+        }
+    }
+    return cnt;
+}
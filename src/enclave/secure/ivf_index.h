@@ -0,0 +1,93 @@
+#pragma once
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "distance.h"
+#include "pq_codec.h"
+#include "quantize.h"
+
+// IVF-Flat index over fixed dimension embeddings.
+//
+// Entries are partitioned into inverted lists by their nearest k-means
+// centroid, each list keeps its vectors in DIST_BLOCK-row blocks (see
+// distance.h). A search only scans the nprobe lists whose centroids are
+// nearest to the probe, the distances inside those lists are exact, so
+// nprobe == nlist() is an exhaustive search.
+//
+// Before train() there is a single list and every search is exhaustive.
+// Vectors are stored as given, callers normalize them for DISTANCE_COSINE.
+//
+// With STORAGE_FP16 or STORAGE_INT8 the lists hold reduced precision vectors
+// plus a scale and squared norm per row. With STORAGE_PQ they hold the codes
+// of a trained codec, scored through a lookup table built once per search.
+// The distances reported by search() are then approximations, to be
+// re-ranked by the caller.
+class IvfIndex
+{
+   public:
+    // codec is required for STORAGE_PQ and must outlive the index
+    IvfIndex(int dim, DistanceMetric metric,
+             VectorStorage storage = STORAGE_FLOAT32,
+             const PqCodec *codec = nullptr);
+
+    int size() const { return (int)m_where.size(); }
+    int nlist() const { return (int)m_lists.size(); }
+    bool trained() const { return m_trained; }
+    VectorStorage storage() const { return m_storage; }
+    // bytes held by the lists and centroids
+    size_t memory_bytes() const;
+
+    // insert the vector of id, or replace it if id is already present
+    void add(int id, const float *v);
+
+    // cluster the current entries into nlist lists with iters rounds of
+    // k-means on at most max_samples of them, then redistribute every entry
+    void train(int nlist, int iters, int max_samples);
+
+    // the k nearest entries among the nprobe nearest lists in ascending
+    // distance, returns how many were found. cosine distance is 1 - dot.
+    int search(const float *probe, int nprobe, int k, int *ids,
+               float *dists) const;
+
+   private:
+    struct List
+    {
+        std::vector<int> ids;
+        // DIST_BLOCK-row blocks of storage elements
+        std::vector<uint8_t> blocks;
+        // per row, STORAGE_FP16 and STORAGE_INT8 only
+        std::vector<float> scales;
+        std::vector<float> sqnorms;
+    };
+
+    bool has_scales() const
+    {
+        return m_storage == STORAGE_FP16 || m_storage == STORAGE_INT8;
+    }
+    size_t block_bytes() const;
+    void append(int list, int id, const float *v);
+    void remove(int id);
+    // v == nullptr clears the row
+    void set_row(List &list, int slot, const float *v);
+    void get_row(const List &list, int slot, float *v) const;
+    void move_row(List &list, int from, int to);
+    void score_block(const List &list, int base, const float *probe,
+                     float probe_sqnorm, const float *lut, float *dists) const;
+    // nearest centroids of v in ascending distance
+    void rank_centroids(const float *v, int n, int *lists) const;
+
+    int m_dim;
+    DistanceMetric m_metric;
+    VectorStorage m_storage;
+    const PqCodec *m_codec;
+    // storage elements per row, dim or the code size
+    int m_row_elems;
+    size_t m_elem_size;
+    bool m_trained;
+    // centroids packed like the list blocks
+    std::vector<float> m_centroids;
+    std::vector<List> m_lists;
+    // id -> (list, slot)
+    std::unordered_map<int, std::pair<int, int>> m_where;
+};
@@ -0,0 +1,76 @@
+#include "kmeans.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "distance.h"
+
+std::vector<float> pack_blocks(const float *rows, int n, int dim)
+{
+    std::vector<float> blocks(
+        (size_t)(n + DIST_BLOCK - 1) / DIST_BLOCK * DIST_BLOCK * dim, 0.f);
+    for (int r = 0; r < n; r++) {
+        float *block = blocks.data() + (size_t)(r / DIST_BLOCK) * DIST_BLOCK * dim;
+        for (int d = 0; d < dim; d++)
+            block[d * DIST_BLOCK + r % DIST_BLOCK] = rows[(size_t)r * dim + d];
+    }
+    return blocks;
+}
+
+void block_distances(const float *v, const float *blocks, int n, int dim,
+                     float *dists)
+{
+    for (int base = 0; base < n; base += DIST_BLOCK)
+        l2_block(v, blocks + (size_t)base * dim, dim, dists + base);
+}
+
+void kmeans(const float *samples, int n, int dim, int k, int iters,
+            float *centroids)
+{
+    for (int c = 0; c < k; c++) {
+        memcpy(centroids + (size_t)c * dim,
+               samples + (size_t)c * n / k * dim, dim * sizeof(float));
+    }
+
+    std::vector<int> assign(n);
+    std::vector<int> counts(k);
+    std::vector<float> dists((size_t)(k + DIST_BLOCK - 1) / DIST_BLOCK *
+                             DIST_BLOCK);
+    for (int iter = 0; iter < iters; iter++) {
+        std::vector<float> packed = pack_blocks(centroids, k, dim);
+        for (int s = 0; s < n; s++) {
+            block_distances(samples + (size_t)s * dim, packed.data(), k, dim,
+                            dists.data());
+            assign[s] = (int)(std::min_element(dists.begin(),
+                                               dists.begin() + k) -
+                              dists.begin());
+        }
+
+        std::fill(centroids, centroids + (size_t)k * dim, 0.f);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (int s = 0; s < n; s++) {
+            float *c = centroids + (size_t)assign[s] * dim;
+            const float *v = samples + (size_t)s * dim;
+            for (int d = 0; d < dim; d++) c[d] += v[d];
+            counts[assign[s]]++;
+        }
+        for (int c = 0; c < k; c++) {
+            if (!counts[c]) continue;
+            float *centroid = centroids + (size_t)c * dim;
+            for (int d = 0; d < dim; d++) centroid[d] /= counts[c];
+        }
+        for (int c = 0; c < k; c++) {
+            if (counts[c]) continue;
+            int big = (int)(std::max_element(counts.begin(), counts.end()) -
+                            counts.begin());
+            float *empty = centroids + (size_t)c * dim;
+            float *largest = centroids + (size_t)big * dim;
+            for (int d = 0; d < dim; d++) {
+                empty[d] = largest[d] * (1.f + 1e-3f);
+                largest[d] *= 1.f - 1e-3f;
+            }
+            counts[c] = counts[big] / 2;
+            counts[big] -= counts[c];
+        }
+    }
+}
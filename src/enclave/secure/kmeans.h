@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+
+// pack n row-major vectors into zero padded DIST_BLOCK-row blocks
+std::vector<float> pack_blocks(const float *rows, int n, int dim);
+
+// squared L2 distances from v to the n rows of packed blocks, dists must hold
+// n rounded up to DIST_BLOCK values
+void block_distances(const float *v, const float *blocks, int n, int dim,
+                     float *dists);
+
+// Lloyd's k-means of n row-major samples into k row-major centroids, seeded
+// with evenly spaced samples. An empty cluster is refilled by splitting the
+// largest one.
+void kmeans(const float *samples, int n, int dim, int k, int iters,
+            float *centroids);
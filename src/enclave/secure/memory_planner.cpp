@@ -0,0 +1,189 @@
+#include "memory_planner.h"
+
+#include <algorithm>
+
+namespace {
+
+// bytes a block takes in the arena, including the tail ncnn may read past
+// the end of it, as its own allocators reserve
+inline size_t footprint(size_t size)
+{
+    return ncnn::alignSize(size + NCNN_MALLOC_OVERREAD, NCNN_MALLOC_ALIGN);
+}
+
+inline bool lifetimes_overlap(int a_alloc, int a_free, int b_alloc, int b_free)
+{
+    return a_alloc < b_free && b_alloc < a_free;
+}
+
+}  // namespace
+
+StaticPlanAllocator::StaticPlanAllocator(ncnn::Allocator *fallback)
+    : m_fallback(fallback),
+      m_state(IDLE),
+      m_clock(0),
+      m_cursor(0),
+      m_diverged(false),
+      m_arena(nullptr),
+      m_arena_size(0),
+      m_peak_live(0),
+      m_num_diverted(0)
+{
+}
+
+StaticPlanAllocator::~StaticPlanAllocator()
+{
+    if (m_arena) ncnn::fastFree(m_arena);
+}
+
+void *StaticPlanAllocator::fallback_malloc(size_t size)
+{
+    return m_fallback ? m_fallback->fastMalloc(size) : ncnn::fastMalloc(size);
+}
+
+void StaticPlanAllocator::fallback_free(void *ptr)
+{
+    if (m_fallback)
+        m_fallback->fastFree(ptr);
+    else
+        ncnn::fastFree(ptr);
+}
+
+bool StaticPlanAllocator::in_arena(void *ptr) const
+{
+    return m_arena && (char *)ptr >= m_arena &&
+           (char *)ptr < m_arena + m_arena_size;
+}
+
+void *StaticPlanAllocator::fastMalloc(size_t size)
+{
+    if (m_state == RECORDING) {
+        void *ptr = fallback_malloc(size);
+        m_records.push_back({size, m_clock++, -1, ptr});
+        return ptr;
+    }
+
+    if (m_state == REPLAYING && !m_diverged && m_cursor < m_plan.size() &&
+        m_plan[m_cursor].size == size) {
+        return m_arena + m_plan[m_cursor++].offset;
+    }
+
+    if (m_state == REPLAYING && !m_diverged) {
+        m_diverged = true;
+        m_num_diverted++;
+    }
+    return fallback_malloc(size);
+}
+
+void StaticPlanAllocator::fastFree(void *ptr)
+{
+    if (!ptr || in_arena(ptr)) return;
+
+    if (m_state == RECORDING) {
+        for (auto it = m_records.rbegin(); it != m_records.rend(); ++it) {
+            if (it->ptr == ptr && it->free_time < 0) {
+                it->free_time = m_clock++;
+                break;
+            }
+        }
+    }
+    fallback_free(ptr);
+}
+
+void StaticPlanAllocator::begin_inference()
+{
+    m_cursor = 0;
+    m_diverged = false;
+    if (m_state == IDLE) {
+        m_records.clear();
+        m_clock = 0;
+        m_state = RECORDING;
+    }
+}
+
+void StaticPlanAllocator::end_inference()
+{
+    if (m_state != RECORDING) return;
+
+    // blocks still referenced by the caller (e.g. the extracted output) live
+    // until the end of the inference
+    for (auto &record : m_records) {
+        if (record.free_time < 0) record.free_time = m_clock;
+    }
+
+    build_plan();
+    m_records.clear();
+    m_records.shrink_to_fit();
+}
+
+void StaticPlanAllocator::build_plan()
+{
+    const int n = (int)m_records.size();
+    m_plan.resize(n);
+
+    // lower bound: the largest sum of footprints alive at the same time
+    m_peak_live = 0;
+    for (int t = 0; t < m_clock; t++) {
+        size_t live = 0;
+        for (const auto &record : m_records) {
+            if (record.alloc_time <= t && t < record.free_time)
+                live += footprint(record.size);
+        }
+        m_peak_live = std::max(m_peak_live, live);
+    }
+
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return m_records[a].size > m_records[b].size;
+    });
+
+    std::vector<int> placed;
+    std::vector<int> conflicts;
+    size_t arena_size = 0;
+    for (int i : order) {
+        const Record &record = m_records[i];
+        const size_t size = footprint(record.size);
+
+        conflicts.clear();
+        for (int j : placed) {
+            const Record &other = m_records[j];
+            if (lifetimes_overlap(record.alloc_time, record.free_time,
+                                  other.alloc_time, other.free_time))
+                conflicts.push_back(j);
+        }
+        std::sort(conflicts.begin(), conflicts.end(), [&](int a, int b) {
+            return m_plan[a].offset < m_plan[b].offset;
+        });
+
+        // best fit: the smallest gap between conflicting blocks that holds
+        // this one, otherwise right after the last of them
+        size_t best_offset = 0;
+        size_t best_gap = (size_t)-1;
+        size_t prev_end = 0;
+        for (int j : conflicts) {
+            const size_t offset = m_plan[j].offset;
+            if (offset >= prev_end + size && offset - prev_end < best_gap) {
+                best_gap = offset - prev_end;
+                best_offset = prev_end;
+            }
+            prev_end = std::max(prev_end, offset + footprint(m_plan[j].size));
+        }
+        if (best_gap == (size_t)-1) best_offset = prev_end;
+
+        m_plan[i] = {record.size, best_offset};
+        placed.push_back(i);
+        arena_size = std::max(arena_size, best_offset + size);
+    }
+
+    m_arena = (char *)ncnn::fastMalloc(arena_size);
+    if (!m_arena) {
+        // stay on the fallback allocator rather than record and plan again on
+        // every inference while memory is short
+        m_plan.clear();
+        m_state = DISABLED;
+        return;
+    }
+    m_arena_size = arena_size;
+    m_state = REPLAYING;
+}
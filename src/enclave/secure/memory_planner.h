@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "allocator.h"
+
+// Static memory planner for a fixed ncnn graph.
+//
+// The first inference runs on the fallback allocator while every allocation
+// and release is recorded. end_inference() then turns the recorded events into
+// liveness intervals and assigns each block an offset inside one arena, placing
+// the largest blocks first into the lowest gap that no block with an
+// overlapping lifetime occupies. The arena is sized to that packing, which is
+// bounded below by the peak live set.
+//
+// Later inferences replay the plan: the k-th allocation of an inference gets
+// the k-th planned offset, so running the graph performs no dynamic allocation.
+// An allocation that does not match the plan (different size or more
+// allocations than recorded) diverts the rest of that inference to the
+// fallback allocator.
+//
+// If the arena cannot be allocated the planner is disabled for good: every
+// later inference runs on the fallback allocator without recording again.
+//
+// Not thread-safe: the replay relies on a deterministic allocation order.
+class StaticPlanAllocator : public ncnn::Allocator
+{
+   public:
+    // a null fallback means ncnn::fastMalloc/fastFree
+    explicit StaticPlanAllocator(ncnn::Allocator *fallback = nullptr);
+    virtual ~StaticPlanAllocator() override;
+
+    virtual void *fastMalloc(size_t size) override;
+    virtual void fastFree(void *ptr) override;
+
+    void begin_inference();
+    void end_inference();
+
+    bool planned() const { return m_state == REPLAYING; }
+    size_t arena_size() const { return m_arena_size; }
+    size_t peak_live() const { return m_peak_live; }
+    int num_blocks() const { return (int)m_plan.size(); }
+    size_t num_diverted() const { return m_num_diverted; }
+
+   private:
+    enum State
+    {
+        IDLE,
+        RECORDING,
+        REPLAYING,
+        DISABLED
+    };
+
+    struct Record
+    {
+        size_t size;
+        int alloc_time;
+        int free_time;
+        void *ptr;
+    };
+
+    struct PlannedBlock
+    {
+        size_t size;
+        size_t offset;
+    };
+
+    void build_plan();
+    void *fallback_malloc(size_t size);
+    void fallback_free(void *ptr);
+    bool in_arena(void *ptr) const;
+
+    ncnn::Allocator *m_fallback;
+    State m_state;
+    std::vector<Record> m_records;
+    std::vector<PlannedBlock> m_plan;
+    int m_clock;
+    size_t m_cursor;
+    bool m_diverged;
+    char *m_arena;
+    size_t m_arena_size;
+    size_t m_peak_live;
+    size_t m_num_diverted;
+};
@@ -0,0 +1,127 @@
+#include "pq_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "kmeans.h"
+
+namespace {
+
+struct CodebookHeader
+{
+    uint32_t magic;
+    uint32_t dim;
+    uint32_t m;
+    uint32_t ksub;
+};
+
+const uint32_t CODEBOOK_MAGIC = 0x42435150;  // "PQCB"
+
+}  // namespace
+
+PqCodec::PqCodec(int dim, int m)
+    : m_dim(dim), m_m(m), m_dsub(dim / m), m_trained(false)
+{
+}
+
+void PqCodec::train(const float *samples, int n, int iters)
+{
+    m_centroids.assign((size_t)m_m * PQ_KSUB * m_dsub, 0.f);
+    m_packed.clear();
+
+    std::vector<float> sub((size_t)n * m_dsub);
+    for (int q = 0; q < m_m; q++) {
+        for (int s = 0; s < n; s++) {
+            memcpy(sub.data() + (size_t)s * m_dsub,
+                   samples + (size_t)s * m_dim + q * m_dsub,
+                   m_dsub * sizeof(float));
+        }
+        float *centroids = m_centroids.data() + (size_t)q * PQ_KSUB * m_dsub;
+        kmeans(sub.data(), n, m_dsub, PQ_KSUB, iters, centroids);
+
+        std::vector<float> packed = pack_blocks(centroids, PQ_KSUB, m_dsub);
+        m_packed.insert(m_packed.end(), packed.begin(), packed.end());
+    }
+    m_trained = true;
+}
+
+void PqCodec::encode(const float *v, uint8_t *code) const
+{
+    float dists[PQ_KSUB];
+    for (int q = 0; q < m_m; q++) {
+        block_distances(v + q * m_dsub,
+                        m_packed.data() + (size_t)q * PQ_KSUB * m_dsub,
+                        PQ_KSUB, m_dsub, dists);
+        code[q] = (uint8_t)(std::min_element(dists, dists + PQ_KSUB) - dists);
+    }
+}
+
+void PqCodec::decode(const uint8_t *code, float *v) const
+{
+    for (int q = 0; q < m_m; q++) {
+        memcpy(v + q * m_dsub,
+               m_centroids.data() + ((size_t)q * PQ_KSUB + code[q]) * m_dsub,
+               m_dsub * sizeof(float));
+    }
+}
+
+void PqCodec::compute_lut(const float *probe, DistanceMetric metric,
+                          float *lut) const
+{
+    for (int q = 0; q < m_m; q++) {
+        const float *packed = m_packed.data() + (size_t)q * PQ_KSUB * m_dsub;
+        float *table = lut + q * PQ_KSUB;
+        for (int base = 0; base < PQ_KSUB; base += DIST_BLOCK) {
+            if (metric == DISTANCE_COSINE)
+                dot_block(probe + q * m_dsub, packed + (size_t)base * m_dsub,
+                          m_dsub, table + base);
+            else
+                l2_block(probe + q * m_dsub, packed + (size_t)base * m_dsub,
+                         m_dsub, table + base);
+        }
+    }
+}
+
+float PqCodec::adc(const float *lut, const uint8_t *code) const
+{
+    float sum = 0.f;
+    for (int q = 0; q < m_m; q++) sum += lut[q * PQ_KSUB + code[q]];
+    return sum;
+}
+
+size_t PqCodec::serialized_size() const
+{
+    return sizeof(CodebookHeader) + (size_t)m_m * PQ_KSUB * m_dsub * sizeof(float);
+}
+
+void PqCodec::serialize(char *buf) const
+{
+    CodebookHeader header = {CODEBOOK_MAGIC, (uint32_t)m_dim, (uint32_t)m_m,
+                             (uint32_t)PQ_KSUB};
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), m_centroids.data(),
+           m_centroids.size() * sizeof(float));
+}
+
+bool PqCodec::deserialize(const char *buf, size_t len)
+{
+    CodebookHeader header;
+    if (len < serialized_size()) return false;
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != CODEBOOK_MAGIC || header.dim != (uint32_t)m_dim ||
+        header.m != (uint32_t)m_m || header.ksub != (uint32_t)PQ_KSUB)
+        return false;
+
+    m_centroids.resize((size_t)m_m * PQ_KSUB * m_dsub);
+    memcpy(m_centroids.data(), buf + sizeof(header),
+           m_centroids.size() * sizeof(float));
+
+    m_packed.clear();
+    for (int q = 0; q < m_m; q++) {
+        std::vector<float> packed = pack_blocks(
+            m_centroids.data() + (size_t)q * PQ_KSUB * m_dsub, PQ_KSUB, m_dsub);
+        m_packed.insert(m_packed.end(), packed.begin(), packed.end());
+    }
+    m_trained = true;
+    return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "distance.h"
+
+// Product quantizer.
+//
+// A vector is split into m subvectors of dim / m components, each encoded as
+// the index of its nearest centroid among PQ_KSUB trained for that subspace,
+// so a code takes m bytes. Distances are computed asymmetrically (ADC): the
+// probe stays in float, compute_lut() tabulates its distance to every
+// centroid of every subspace once, and scoring a code is m table lookups.
+class PqCodec
+{
+   public:
+    static const int PQ_KSUB = 256;
+
+    // m must divide dim
+    PqCodec(int dim, int m);
+
+    bool trained() const { return m_trained; }
+    int dim() const { return m_dim; }
+    int code_size() const { return m_m; }
+
+    // k-means per subspace on n row-major samples
+    void train(const float *samples, int n, int iters);
+
+    void encode(const float *v, uint8_t *code) const;
+    void decode(const uint8_t *code, float *v) const;
+
+    // lut receives m * PQ_KSUB values: squared L2 distances of the probe
+    // subvectors to the centroids, or inner products for DISTANCE_COSINE
+    void compute_lut(const float *probe, DistanceMetric metric,
+                     float *lut) const;
+    float adc(const float *lut, const uint8_t *code) const;
+
+    // the codebook as a flat byte buffer, for sealing
+    size_t serialized_size() const;
+    void serialize(char *buf) const;
+    // false if buf does not hold a codebook for this dim and m
+    bool deserialize(const char *buf, size_t len);
+
+   private:
+    int m_dim;
+    int m_m;
+    int m_dsub;
+    bool m_trained;
+    // m * PQ_KSUB * dsub, subspace major
+    std::vector<float> m_centroids;
+    // the centroids of each subspace packed into DIST_BLOCK-row blocks
+    std::vector<float> m_packed;
+};
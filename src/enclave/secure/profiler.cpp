@@ -0,0 +1,169 @@
+#include "profiler.h"
+
+#include "../insecure/file.h"
+#include "layer.h"
+#include "net.h"
+
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+std::vector<ProfileRecord> g_records;
+uint32_t g_dropped = 0;
+
+// forwards everything to the wrapped layer and records the time of each
+// forward call
+class ProfiledLayer : public ncnn::Layer
+{
+   public:
+    ProfiledLayer(ncnn::Layer *layer, int index) : m_layer(layer), m_index(index)
+    {
+        one_blob_only = layer->one_blob_only;
+        support_inplace = layer->support_inplace;
+        support_vulkan = layer->support_vulkan;
+        support_packing = layer->support_packing;
+        support_bf16_storage = layer->support_bf16_storage;
+        support_fp16_storage = layer->support_fp16_storage;
+        support_int8_storage = layer->support_int8_storage;
+        support_image_storage = layer->support_image_storage;
+        support_tensor_storage = layer->support_tensor_storage;
+        featmask = layer->featmask;
+        typeindex = layer->typeindex;
+#if NCNN_STRING
+        type = layer->type;
+        name = layer->name;
+#endif
+        bottoms = layer->bottoms;
+        tops = layer->tops;
+        bottom_shapes = layer->bottom_shapes;
+        top_shapes = layer->top_shapes;
+    }
+
+    virtual ~ProfiledLayer() override { delete m_layer; }
+
+    virtual int destroy_pipeline(const ncnn::Option &opt) override
+    {
+        return m_layer->destroy_pipeline(opt);
+    }
+
+    virtual int forward(const std::vector<ncnn::Mat> &bottom_blobs,
+                        std::vector<ncnn::Mat> &top_blobs,
+                        const ncnn::Option &opt) const override
+    {
+        uint64_t start = profile_cycles();
+        int ret = m_layer->forward(bottom_blobs, top_blobs, opt);
+        record(start);
+        return ret;
+    }
+
+    virtual int forward(const ncnn::Mat &bottom_blob, ncnn::Mat &top_blob,
+                        const ncnn::Option &opt) const override
+    {
+        uint64_t start = profile_cycles();
+        int ret = m_layer->forward(bottom_blob, top_blob, opt);
+        record(start);
+        return ret;
+    }
+
+    virtual int forward_inplace(std::vector<ncnn::Mat> &bottom_top_blobs,
+                                const ncnn::Option &opt) const override
+    {
+        uint64_t start = profile_cycles();
+        int ret = m_layer->forward_inplace(bottom_top_blobs, opt);
+        record(start);
+        return ret;
+    }
+
+    virtual int forward_inplace(ncnn::Mat &bottom_top_blob,
+                                const ncnn::Option &opt) const override
+    {
+        uint64_t start = profile_cycles();
+        int ret = m_layer->forward_inplace(bottom_top_blob, opt);
+        record(start);
+        return ret;
+    }
+
+   private:
+    void record(uint64_t start) const
+    {
+        profile_add(PROF_LAYER, (uint32_t)m_index, (uint16_t)typeindex,
+                    profile_cycles() - start);
+    }
+
+    ncnn::Layer *m_layer;
+    int m_index;
+};
+
+uint32_t profile_clock()
+{
+#if defined(__riscv)
+    return CLOCK_RDCYCLE;
+#elif defined(__x86_64__) || defined(__i386__)
+    return CLOCK_RDTSC;
+#else
+    return CLOCK_NONE;
+#endif
+}
+
+}  // namespace
+
+uint64_t profile_cycles()
+{
+#if defined(__riscv)
+    uint64_t cycles;
+    asm volatile("rdcycle %0" : "=r"(cycles));
+    return cycles;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void profile_add(ProfileEvent event, uint32_t id, uint16_t aux, uint64_t cycles)
+{
+    if (g_records.size() >= PROFILE_MAX_RECORDS) {
+        g_dropped++;
+        return;
+    }
+    g_records.push_back({(uint16_t)event, aux, id, cycles});
+}
+
+void profile_net_layers(ncnn::Net *net)
+{
+    std::vector<ncnn::Layer *> &layers = net->mutable_layers();
+    for (size_t i = 0; i < layers.size(); i++) {
+        layers[i] = new ProfiledLayer(layers[i], (int)i);
+    }
+}
+
+ProfileRequestScope::ProfileRequestScope(ProfileRequest request)
+    : m_request(request)
+{
+    g_records.clear();
+    g_records.reserve(PROFILE_MAX_RECORDS);
+    g_dropped = 0;
+    m_start = profile_cycles();
+}
+
+ProfileRequestScope::~ProfileRequestScope()
+{
+    profile_add(PROF_REQUEST, m_request, 0, profile_cycles() - m_start);
+
+    ProfileHeader header = {PROFILE_MAGIC, profile_clock(),
+                            (uint32_t)g_records.size(), g_dropped};
+    std::vector<char> trace(sizeof(header) +
+                            g_records.size() * sizeof(ProfileRecord));
+    memcpy(trace.data(), &header, sizeof(header));
+    if (!g_records.empty()) {
+        memcpy(trace.data() + sizeof(header), g_records.data(),
+               g_records.size() * sizeof(ProfileRecord));
+    }
+    write_profile(trace.data(), (int)trace.size());
+    g_records.clear();
+}
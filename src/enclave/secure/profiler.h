@@ -0,0 +1,114 @@
+#pragma once
+#include <cstdint>
+
+namespace ncnn {
+class Net;
+}
+
+// set to 1 to trace where the time of every ecall goes. The trace of a request
+// leaves the enclave in a single write_profile ocall when the ecall returns,
+// the host appends it to profile.bin (scripts/decode_profile.py prints it).
+#define ENCLAVE_PROFILE 0
+
+// ecalls that start a trace
+enum ProfileRequest
+{
+    REQ_RECORD,
+    REQ_RECORD_BATCH,
+    REQ_VERIFY,
+    REQ_PQ_TRAIN,
+};
+
+enum ProfileEvent
+{
+    PROF_REQUEST,     // whole ecall, id is the ProfileRequest
+    PROF_LOAD_MODEL,  // load_param + load_model, id is 1 for the int8 model
+    PROF_LAYER,       // one layer forward, id is the layer index, aux its type
+    PROF_READ_FILE,   // ocalls, id is the payload size in bytes
+    PROF_LIST_RECORDS,
+    PROF_WRITE_FILE,
+    PROF_WRITE_FILES,
+    PROF_SEAL,  // id is the plaintext size in bytes
+    PROF_UNSEAL,
+    PROF_ENCRYPT,  // gallery chunk encryption, id is the size in bytes
+    PROF_DECRYPT,
+    PROF_READ_RECORDS,  // id is the buffer size in bytes
+};
+
+// Trace layout, little endian: one ProfileHeader followed by count records.
+#define PROFILE_MAGIC 0x31465250  // "PRF1"
+
+enum ProfileClock
+{
+    CLOCK_NONE,
+    CLOCK_RDCYCLE,
+    CLOCK_RDTSC,
+};
+
+struct ProfileHeader
+{
+    uint32_t magic;
+    uint32_t clock;
+    uint32_t count;
+    uint32_t dropped;  // records beyond PROFILE_MAX_RECORDS
+};
+
+struct ProfileRecord
+{
+    uint16_t event;
+    uint16_t aux;
+    uint32_t id;
+    uint64_t cycles;
+};
+
+// records kept per request, later ones are only counted
+#define PROFILE_MAX_RECORDS 4096
+
+// rdcycle on RISC-V, rdtsc on x86, 0 elsewhere
+uint64_t profile_cycles();
+
+void profile_add(ProfileEvent event, uint32_t id, uint16_t aux, uint64_t cycles);
+
+// wrap every layer of a loaded net so that each forward is recorded, must run
+// after anything that looks at the layer objects themselves (fuse_rvv_prelu)
+void profile_net_layers(ncnn::Net *net);
+
+class ProfileScope
+{
+   public:
+    ProfileScope(ProfileEvent event, uint32_t id)
+        : m_event(event), m_id(id), m_start(profile_cycles())
+    {
+    }
+    ~ProfileScope() { profile_add(m_event, m_id, 0, profile_cycles() - m_start); }
+
+   private:
+    ProfileEvent m_event;
+    uint32_t m_id;
+    uint64_t m_start;
+};
+
+// starts a fresh trace, records the whole request and sends the trace out
+class ProfileRequestScope
+{
+   public:
+    explicit ProfileRequestScope(ProfileRequest request);
+    ~ProfileRequestScope();
+
+   private:
+    ProfileRequest m_request;
+    uint64_t m_start;
+};
+
+#define PROFILE_CAT2(a, b) a##b
+#define PROFILE_CAT(a, b) PROFILE_CAT2(a, b)
+
+#if ENCLAVE_PROFILE
+#define PROFILE_SCOPE(event, id) \
+    ProfileScope PROFILE_CAT(profile_scope_, __LINE__)(event, id)
+#define PROFILE_REQUEST(request) \
+    ProfileRequestScope PROFILE_CAT(profile_request_, __LINE__)(request)
+#else
+#define PROFILE_SCOPE(event, id)
+#define PROFILE_REQUEST(request)
+#endif
@@ -0,0 +1,97 @@
+#include "quantize.h"
+
+#include <cmath>
+#include <cstring>
+
+size_t storage_elem_size(VectorStorage storage)
+{
+    switch (storage) {
+        case STORAGE_FP16:
+            return sizeof(uint16_t);
+        case STORAGE_INT8:
+        case STORAGE_PQ:
+            return sizeof(uint8_t);
+        default:
+            return sizeof(float);
+    }
+}
+
+// IEEE 754 binary16 conversions with round to nearest even
+uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t abs = x & 0x7fffffff;
+
+    if (abs >= 0x7f800000) {
+        // inf or nan
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+        // overflows to inf after rounding
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // subnormal half or zero
+        if (abs < 0x33000000) return sign;
+        const uint32_t mant = (abs & 0x7fffff) | 0x800000;
+        const int shift = 126 - (int)(abs >> 23);
+        uint32_t half = mant >> shift;
+        const uint32_t rest = mant & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return sign | half;
+    }
+
+    uint32_t half = ((abs - 0x38000000) >> 13);
+    const uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return sign | half;
+}
+
+float half_to_float(uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+
+    uint32_t x;
+    if (exp == 0x1f) {
+        x = sign | 0x7f800000 | (mant << 13);
+    }
+    else if (exp) {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    else if (mant) {
+        // renormalize a subnormal half
+        int e = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            e--;
+        }
+        x = sign | ((uint32_t)e << 23) | ((mant & 0x3ff) << 13);
+    }
+    else {
+        x = sign;
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+float quantize_s8(const float *v, int dim, int8_t *q)
+{
+    float max_abs = 0.f;
+    for (int i = 0; i < dim; i++) max_abs = fmaxf(max_abs, fabsf(v[i]));
+
+    const float scale = max_abs / 127.f;
+    const float inv = scale > 0.f ? 1.f / scale : 0.f;
+    for (int i = 0; i < dim; i++) {
+        float r = roundf(v[i] * inv);
+        q[i] = (int8_t)(r > 127.f ? 127.f : (r < -127.f ? -127.f : r));
+    }
+    return scale;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// How an index keeps its vectors.
+//
+// STORAGE_FP16 and STORAGE_INT8 store every vector in reduced precision, with
+// a per-vector scale for int8 (v ~= scale * q, q in [-127, 127]). STORAGE_PQ
+// stores product quantization codes (see pq_codec.h). Scores on them are
+// approximate and are meant to be re-ranked on full precision vectors.
+enum VectorStorage
+{
+    STORAGE_FLOAT32,
+    STORAGE_FP16,
+    STORAGE_INT8,
+    STORAGE_PQ,
+};
+
+// bytes per vector component, per code byte for STORAGE_PQ
+size_t storage_elem_size(VectorStorage storage);
+
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+// scale of the symmetric int8 quantization of v, q receives dim codes
+float quantize_s8(const float *v, int dim, int8_t *q);
@@ -0,0 +1,547 @@
+#include "rvv_layers.h"
+
+#include "cpu.h"
+#include "layer.h"
+#include "layer_type.h"
+#include "modelbin.h"
+#include "paramdict.h"
+#include "thread_pool.h"
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#define LAYERS_RVV 1
+#endif
+
+#include <cstdint>
+
+namespace {
+
+// one channel of a 3x3 depthwise conv over an already padded input, followed
+// by y = y < 0 ? y * slope : y (slope 1 means no activation)
+typedef void (*dw3x3_kernel)(const float *in, int in_w, int stride,
+                             const float *k, float bias, float slope,
+                             float *out, int out_w, int out_h);
+// 1x1 conv of inch planes of size floats into outch planes, slope of output o
+// is slopes[o * slope_step]
+typedef void (*pointwise_kernel)(const float *in, size_t in_cstep, int inch,
+                                 const float *w, const float *bias,
+                                 const float *slopes, int slope_step,
+                                 float *out, size_t out_cstep, int outch,
+                                 int size);
+typedef void (*prelu_kernel)(float *ptr, int size, float slope);
+
+void dw3x3_c(const float *in, int in_w, int stride, const float *k, float bias,
+             float slope, float *out, int out_w, int out_h)
+{
+    for (int i = 0; i < out_h; i++) {
+        const float *r0 = in + i * stride * in_w;
+        const float *r1 = r0 + in_w;
+        const float *r2 = r1 + in_w;
+        for (int j = 0; j < out_w; j++) {
+            const int x = j * stride;
+            float v = bias;
+            v += k[0] * r0[x] + k[1] * r0[x + 1] + k[2] * r0[x + 2];
+            v += k[3] * r1[x] + k[4] * r1[x + 1] + k[5] * r1[x + 2];
+            v += k[6] * r2[x] + k[7] * r2[x + 1] + k[8] * r2[x + 2];
+            out[i * out_w + j] = v < 0.f ? v * slope : v;
+        }
+    }
+}
+
+void pointwise_c(const float *in, size_t in_cstep, int inch, const float *w,
+                 const float *bias, const float *slopes, int slope_step,
+                 float *out, size_t out_cstep, int outch, int size)
+{
+    for (int o = 0; o < outch; o++) {
+        float *dst = out + o * out_cstep;
+        const float *wo = w + o * inch;
+        for (int p = 0; p < size; p++) dst[p] = bias[o];
+        for (int c = 0; c < inch; c++) {
+            const float *src = in + c * in_cstep;
+            const float k = wo[c];
+            for (int p = 0; p < size; p++) dst[p] += k * src[p];
+        }
+        const float slope = slopes[o * slope_step];
+        for (int p = 0; p < size; p++) {
+            if (dst[p] < 0.f) dst[p] *= slope;
+        }
+    }
+}
+
+void prelu_c(float *ptr, int size, float slope)
+{
+    for (int i = 0; i < size; i++) {
+        if (ptr[i] < 0.f) ptr[i] *= slope;
+    }
+}
+
+#if LAYERS_RVV
+inline void store_prelu(float *dst, vfloat32m4_t v, float slope, size_t vl)
+{
+    vbool8_t neg = __riscv_vmflt_vf_f32m4_b8(v, 0.f, vl);
+    v = __riscv_vfmul_vf_f32m4_mu(neg, v, v, slope, vl);
+    __riscv_vse32_v_f32m4(dst, v, vl);
+}
+
+inline vfloat32m4_t load_row(const float *p, int stride, size_t vl)
+{
+    if (stride == 1) return __riscv_vle32_v_f32m4(p, vl);
+    return __riscv_vlse32_v_f32m4(p, stride * sizeof(float), vl);
+}
+
+// output columns go into the vector lanes, stride 2 uses strided loads
+void dw3x3_rvv(const float *in, int in_w, int stride, const float *k,
+               float bias, float slope, float *out, int out_w, int out_h)
+{
+    for (int i = 0; i < out_h; i++) {
+        const float *r0 = in + i * stride * in_w;
+        const float *r1 = r0 + in_w;
+        const float *r2 = r1 + in_w;
+        for (int j = 0; j < out_w;) {
+            size_t vl = __riscv_vsetvl_e32m4(out_w - j);
+            const int x = j * stride;
+            vfloat32m4_t acc = __riscv_vfmv_v_f_f32m4(bias, vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[0], load_row(r0 + x, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[1], load_row(r0 + x + 1, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[2], load_row(r0 + x + 2, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[3], load_row(r1 + x, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[4], load_row(r1 + x + 1, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[5], load_row(r1 + x + 2, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[6], load_row(r2 + x, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[7], load_row(r2 + x + 1, stride, vl), vl);
+            acc = __riscv_vfmacc_vf_f32m4(acc, k[8], load_row(r2 + x + 2, stride, vl), vl);
+            store_prelu(out + i * out_w + j, acc, slope, vl);
+            j += vl;
+        }
+    }
+}
+
+// pixels go into the vector lanes, four output channels share every input load
+void pointwise_rvv(const float *in, size_t in_cstep, int inch, const float *w,
+                   const float *bias, const float *slopes, int slope_step,
+                   float *out, size_t out_cstep, int outch, int size)
+{
+    int o = 0;
+    for (; o + 3 < outch; o += 4) {
+        const float *w0 = w + o * inch;
+        const float *w1 = w0 + inch;
+        const float *w2 = w1 + inch;
+        const float *w3 = w2 + inch;
+        for (int p = 0; p < size;) {
+            size_t vl = __riscv_vsetvl_e32m4(size - p);
+            vfloat32m4_t a0 = __riscv_vfmv_v_f_f32m4(bias[o], vl);
+            vfloat32m4_t a1 = __riscv_vfmv_v_f_f32m4(bias[o + 1], vl);
+            vfloat32m4_t a2 = __riscv_vfmv_v_f_f32m4(bias[o + 2], vl);
+            vfloat32m4_t a3 = __riscv_vfmv_v_f_f32m4(bias[o + 3], vl);
+            const float *src = in + p;
+            for (int c = 0; c < inch; c++) {
+                vfloat32m4_t v = __riscv_vle32_v_f32m4(src, vl);
+                a0 = __riscv_vfmacc_vf_f32m4(a0, w0[c], v, vl);
+                a1 = __riscv_vfmacc_vf_f32m4(a1, w1[c], v, vl);
+                a2 = __riscv_vfmacc_vf_f32m4(a2, w2[c], v, vl);
+                a3 = __riscv_vfmacc_vf_f32m4(a3, w3[c], v, vl);
+                src += in_cstep;
+            }
+            float *dst = out + o * out_cstep + p;
+            store_prelu(dst, a0, slopes[o * slope_step], vl);
+            store_prelu(dst + out_cstep, a1, slopes[(o + 1) * slope_step], vl);
+            store_prelu(dst + 2 * out_cstep, a2, slopes[(o + 2) * slope_step], vl);
+            store_prelu(dst + 3 * out_cstep, a3, slopes[(o + 3) * slope_step], vl);
+            p += vl;
+        }
+    }
+    for (; o < outch; o++) {
+        const float *wo = w + o * inch;
+        for (int p = 0; p < size;) {
+            size_t vl = __riscv_vsetvl_e32m4(size - p);
+            vfloat32m4_t acc = __riscv_vfmv_v_f_f32m4(bias[o], vl);
+            const float *src = in + p;
+            for (int c = 0; c < inch; c++) {
+                acc = __riscv_vfmacc_vf_f32m4(
+                    acc, wo[c], __riscv_vle32_v_f32m4(src, vl), vl);
+                src += in_cstep;
+            }
+            store_prelu(out + o * out_cstep + p, acc, slopes[o * slope_step], vl);
+            p += vl;
+        }
+    }
+}
+
+void prelu_rvv(float *ptr, int size, float slope)
+{
+    for (int i = 0; i < size;) {
+        size_t vl = __riscv_vsetvl_e32m4(size - i);
+        store_prelu(ptr + i, __riscv_vle32_v_f32m4(ptr + i, vl), slope, vl);
+        i += vl;
+    }
+}
+#endif  // LAYERS_RVV
+
+struct Kernels
+{
+    dw3x3_kernel dw3x3;
+    pointwise_kernel pointwise;
+    prelu_kernel prelu;
+    const char *isa;
+};
+
+Kernels select_kernels()
+{
+#if LAYERS_RVV
+    if (ncnn::cpu_support_riscv_v())
+        return {dw3x3_rvv, pointwise_rvv, prelu_rvv, "rvv"};
+#endif
+    return {dw3x3_c, pointwise_c, prelu_c, "c"};
+}
+
+const Kernels &kernels()
+{
+    static const Kernels k = select_kernels();
+    return k;
+}
+
+// fn(i) for every i in [0, n), on up to opt.num_threads threads of the shared
+// pool
+template <typename Fn>
+void parallel(int n, const ncnn::Option &opt, Fn fn)
+{
+    ThreadPool *pool = shared_thread_pool();
+    if (!pool || opt.num_threads <= 1 || n <= 1) {
+        for (int i = 0; i < n; i++) fn(i);
+        return;
+    }
+    pool->parallel_for(n, opt.num_threads, fn);
+}
+
+// ConvolutionDepthWise or Convolution, with a fast path for the 3x3 depthwise
+// and 1x1 pointwise shapes and the stock ncnn layer for everything else
+class FastConvolution : public ncnn::Layer
+{
+   public:
+    explicit FastConvolution(int base_type)
+        : m_base_type(base_type),
+          m_base(nullptr),
+          m_activation(false),
+          m_slope_step(0)
+    {
+        one_blob_only = true;
+    }
+
+    virtual ~FastConvolution() override { delete m_base; }
+
+    virtual int load_param(const ncnn::ParamDict &pd) override
+    {
+        m_num_output = pd.get(0, 0);
+        int kernel_w = pd.get(1, 0);
+        int kernel_h = pd.get(11, kernel_w);
+        int dilation_w = pd.get(2, 1);
+        int dilation_h = pd.get(12, dilation_w);
+        int stride_w = pd.get(3, 1);
+        int stride_h = pd.get(13, stride_w);
+        m_pad_left = pd.get(4, 0);
+        m_pad_right = pd.get(15, m_pad_left);
+        m_pad_top = pd.get(14, m_pad_left);
+        m_pad_bottom = pd.get(16, m_pad_top);
+        m_pad_value = pd.get(18, 0.f);
+        m_bias_term = pd.get(5, 0);
+        m_weight_data_size = pd.get(6, 0);
+        int group = pd.get(7, 1);
+        int int8_scale_term = pd.get(8, 0);
+        int activation_type = pd.get(9, 0);
+        ncnn::Mat activation_params = pd.get(10, ncnn::Mat());
+        int dynamic_weight = pd.get(19, 0);
+        m_stride = stride_w;
+
+        bool fast = m_num_output > 0 && !int8_scale_term && !dynamic_weight &&
+                    dilation_w == 1 && dilation_h == 1 &&
+                    stride_w == stride_h && activation_type <= 2 &&
+                    m_pad_left >= 0 && m_pad_right >= 0 && m_pad_top >= 0 &&
+                    m_pad_bottom >= 0;
+        if (m_base_type == ncnn::LayerType::ConvolutionDepthWise) {
+            fast = fast && kernel_w == 3 && kernel_h == 3 &&
+                   (m_stride == 1 || m_stride == 2) &&
+                   group == m_num_output &&
+                   m_weight_data_size == m_num_output * 9;
+        }
+        else {
+            fast = fast && kernel_w == 1 && kernel_h == 1 && m_stride == 1 &&
+                   group == 1 && m_pad_left + m_pad_right + m_pad_top +
+                                         m_pad_bottom == 0 &&
+                   m_weight_data_size % m_num_output == 0;
+        }
+        if (activation_type == 2 && activation_params.w < 1) fast = false;
+
+        if (!fast) {
+            m_base = ncnn::create_layer_cpu(m_base_type);
+            m_base->bottom_shapes = bottom_shapes;
+            m_base->top_shapes = top_shapes;
+            int ret = m_base->load_param(pd);
+            sync_flags();
+            return ret;
+        }
+
+        // the fused activation becomes a shared prelu slope
+        float slope = 1.f;
+        if (activation_type == 1) slope = 0.f;
+        if (activation_type == 2) slope = activation_params[0];
+        m_slopes.create(1);
+        m_slopes[0] = slope;
+        m_slope_step = 0;
+        m_activation = activation_type != 0;
+        return 0;
+    }
+
+    virtual int load_model(const ncnn::ModelBin &mb) override
+    {
+        if (m_base) return m_base->load_model(mb);
+
+        m_weight = mb.load(m_weight_data_size, 0);
+        if (m_weight.empty()) return -100;
+        if (m_bias_term) {
+            m_bias = mb.load(m_num_output, 1);
+            if (m_bias.empty()) return -100;
+        }
+        else {
+            m_bias.create(m_num_output);
+            m_bias.fill(0.f);
+        }
+        return 0;
+    }
+
+    virtual int create_pipeline(const ncnn::Option &opt) override
+    {
+        if (!m_base) return 0;
+        int ret = m_base->create_pipeline(opt);
+        sync_flags();
+        return ret;
+    }
+
+    virtual int destroy_pipeline(const ncnn::Option &opt) override
+    {
+        return m_base ? m_base->destroy_pipeline(opt) : 0;
+    }
+
+    virtual int forward(const std::vector<ncnn::Mat> &bottom_blobs,
+                        std::vector<ncnn::Mat> &top_blobs,
+                        const ncnn::Option &opt) const override
+    {
+        if (m_base) return m_base->forward(bottom_blobs, top_blobs, opt);
+        return forward(bottom_blobs[0], top_blobs[0], opt);
+    }
+
+    virtual int forward(const ncnn::Mat &bottom_blob, ncnn::Mat &top_blob,
+                        const ncnn::Option &opt) const override
+    {
+        if (m_base) return m_base->forward(bottom_blob, top_blob, opt);
+        if (bottom_blob.elempack != 1 || bottom_blob.elemsize != 4) return -1;
+
+        if (m_base_type != ncnn::LayerType::ConvolutionDepthWise) {
+            const int inch = m_weight_data_size / m_num_output;
+            if (bottom_blob.c != inch) return -1;
+            const int size = bottom_blob.w * bottom_blob.h;
+            top_blob.create(bottom_blob.w, bottom_blob.h, m_num_output, 4u,
+                            opt.blob_allocator);
+            if (top_blob.empty()) return -100;
+
+            // each thread gets a range of output channels, in groups of four;
+            // at least one task, or a num_threads of 0 would skip the layer
+            const int groups = (m_num_output + 3) / 4;
+            int tasks = opt.num_threads < groups ? opt.num_threads : groups;
+            if (tasks < 1) tasks = 1;
+            const float *in = bottom_blob;
+            const float *weight = m_weight;
+            const float *bias = m_bias;
+            const float *slopes = m_slopes;
+            float *out = top_blob;
+            parallel(tasks, opt, [&](int t) {
+                int begin = groups * t / tasks * 4;
+                int end = groups * (t + 1) / tasks * 4;
+                if (end > m_num_output) end = m_num_output;
+                kernels().pointwise(in, bottom_blob.cstep, inch,
+                                    weight + begin * inch, bias + begin,
+                                    slopes + begin * m_slope_step, m_slope_step,
+                                    out + begin * top_blob.cstep, top_blob.cstep,
+                                    end - begin, size);
+            });
+            return 0;
+        }
+
+        const int channels = bottom_blob.c;
+        if (channels != m_num_output) return -1;
+
+        ncnn::Mat padded = bottom_blob;
+        if (m_pad_left || m_pad_right || m_pad_top || m_pad_bottom) {
+            ncnn::Option opt_b = opt;
+            opt_b.blob_allocator = opt.workspace_allocator;
+            ncnn::copy_make_border(bottom_blob, padded, m_pad_top, m_pad_bottom,
+                                   m_pad_left, m_pad_right,
+                                   ncnn::BORDER_CONSTANT, m_pad_value, opt_b);
+            if (padded.empty()) return -100;
+        }
+        if (padded.w < 3 || padded.h < 3) return -1;
+
+        const int out_w = (padded.w - 3) / m_stride + 1;
+        const int out_h = (padded.h - 3) / m_stride + 1;
+        top_blob.create(out_w, out_h, channels, 4u, opt.blob_allocator);
+        if (top_blob.empty()) return -100;
+
+        const Kernels &k = kernels();
+        const float *weight = m_weight;
+        parallel(channels, opt, [&](int q) {
+            k.dw3x3(padded.channel(q), padded.w, m_stride, weight + q * 9,
+                    m_bias[q], m_slopes[q * m_slope_step], top_blob.channel(q),
+                    out_w, out_h);
+        });
+        return 0;
+    }
+
+    // take over a prelu on the output, slopes has one or m_num_output entries
+    bool fuse_prelu(const ncnn::Mat &slopes)
+    {
+        if (m_base || m_activation) return false;
+        if (slopes.w != 1 && slopes.w != m_num_output) return false;
+        m_slopes = slopes;
+        m_slope_step = slopes.w == 1 ? 0 : 1;
+        m_activation = true;
+        return true;
+    }
+
+   private:
+    void sync_flags()
+    {
+        one_blob_only = m_base->one_blob_only;
+        support_inplace = m_base->support_inplace;
+        support_packing = m_base->support_packing;
+        support_bf16_storage = m_base->support_bf16_storage;
+        support_fp16_storage = m_base->support_fp16_storage;
+        support_int8_storage = m_base->support_int8_storage;
+    }
+
+    int m_base_type;
+    ncnn::Layer *m_base;  // stock layer for shapes without a fast path
+
+    int m_num_output;
+    int m_stride;
+    int m_pad_left, m_pad_right, m_pad_top, m_pad_bottom;
+    float m_pad_value;
+    int m_bias_term;
+    int m_weight_data_size;
+    bool m_activation;
+
+    ncnn::Mat m_weight;
+    ncnn::Mat m_bias;
+    ncnn::Mat m_slopes;
+    int m_slope_step;
+};
+
+class FastPReLU : public ncnn::Layer
+{
+   public:
+    FastPReLU() : m_fused(false)
+    {
+        one_blob_only = true;
+        support_inplace = true;
+    }
+
+    virtual int load_param(const ncnn::ParamDict &pd) override
+    {
+        m_num_slope = pd.get(0, 0);
+        return 0;
+    }
+
+    virtual int load_model(const ncnn::ModelBin &mb) override
+    {
+        m_slopes = mb.load(m_num_slope, 1);
+        return m_slopes.empty() ? -100 : 0;
+    }
+
+    virtual int forward_inplace(ncnn::Mat &bottom_top_blob,
+                                const ncnn::Option &opt) const override
+    {
+        // the producing conv already applied it
+        if (m_fused) return 0;
+        if (bottom_top_blob.elempack != 1 || bottom_top_blob.elemsize != 4)
+            return -1;
+
+        const Kernels &k = kernels();
+        float *ptr = bottom_top_blob;
+        const int w = bottom_top_blob.w;
+        if (bottom_top_blob.dims == 1) {
+            if (m_num_slope == 1) {
+                k.prelu(ptr, w, m_slopes[0]);
+                return 0;
+            }
+            for (int i = 0; i < w; i++) k.prelu(ptr + i, 1, m_slopes[i]);
+            return 0;
+        }
+        if (bottom_top_blob.dims == 2) {
+            for (int i = 0; i < bottom_top_blob.h; i++) {
+                k.prelu(bottom_top_blob.row(i), w,
+                        m_slopes[m_num_slope > 1 ? i : 0]);
+            }
+            return 0;
+        }
+
+        const int size = w * bottom_top_blob.h * bottom_top_blob.d;
+        parallel(bottom_top_blob.c, opt, [&](int q) {
+            k.prelu(bottom_top_blob.channel(q), size,
+                    m_slopes[m_num_slope > 1 ? q : 0]);
+        });
+        return 0;
+    }
+
+    const ncnn::Mat &slopes() const { return m_slopes; }
+    void set_fused() { m_fused = true; }
+
+   private:
+    int m_num_slope;
+    ncnn::Mat m_slopes;
+    bool m_fused;
+};
+
+ncnn::Layer *create_convolution(void *userdata)
+{
+    return new FastConvolution((int)(intptr_t)userdata);
+}
+
+ncnn::Layer *create_prelu(void *) { return new FastPReLU(); }
+
+}  // namespace
+
+void register_rvv_layers(ncnn::Net *net)
+{
+    net->register_custom_layer(
+        ncnn::LayerType::ConvolutionDepthWise, create_convolution, 0,
+        (void *)(intptr_t)ncnn::LayerType::ConvolutionDepthWise);
+    net->register_custom_layer(ncnn::LayerType::Convolution, create_convolution,
+                               0, (void *)(intptr_t)ncnn::LayerType::Convolution);
+    net->register_custom_layer(ncnn::LayerType::PReLU, create_prelu);
+}
+
+int fuse_rvv_prelu(ncnn::Net *net)
+{
+    // every layer of these types was created by register_rvv_layers
+    const std::vector<ncnn::Layer *> &layers = net->layers();
+    const std::vector<ncnn::Blob> &blobs = net->blobs();
+    int fused = 0;
+    for (ncnn::Layer *layer : layers) {
+        if (layer->typeindex != ncnn::LayerType::PReLU ||
+            layer->bottoms.size() != 1)
+            continue;
+        int producer = blobs[layer->bottoms[0]].producer;
+        if (producer < 0) continue;
+        ncnn::Layer *conv = layers[producer];
+        if (conv->typeindex != ncnn::LayerType::Convolution &&
+            conv->typeindex != ncnn::LayerType::ConvolutionDepthWise)
+            continue;
+
+        FastPReLU *prelu = (FastPReLU *)layer;
+        if (((FastConvolution *)conv)->fuse_prelu(prelu->slopes())) {
+            prelu->set_fused();
+            fused++;
+        }
+    }
+    return fused;
+}
+
+const char *rvv_layers_isa() { return kernels().isa; }
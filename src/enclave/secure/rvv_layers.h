@@ -0,0 +1,27 @@
+#pragma once
+
+#include "net.h"
+
+// MobileFaceNet specific replacements of the ncnn cpu layers.
+//
+// The enclave ncnn is built without NCNN_RVV, so its ConvolutionDepthWise,
+// Convolution and PReLU run scalar. The layers registered here take over the
+// shapes MobileFaceNet uses:
+//   ConvolutionDepthWise  3x3, stride 1 or 2, no dilation
+//   Convolution           1x1 pointwise, stride 1, no padding
+//   PReLU                 any
+// Every other configuration (and int8 weights) is forwarded to the stock ncnn
+// layer. The kernels are picked once at runtime: RISC-V Vector when the enclave
+// is built with V enabled and the hart supports it, plain C otherwise.
+//
+// fuse_rvv_prelu() moves each PReLU into the epilogue of the conv producing
+// its input, the PReLU layer then passes its blob through untouched.
+
+// must be called before load_param
+void register_rvv_layers(ncnn::Net *net);
+
+// must be called after load_model, returns the number of fused PReLU layers
+int fuse_rvv_prelu(ncnn::Net *net);
+
+// "rvv" or "c"
+const char *rvv_layers_isa();
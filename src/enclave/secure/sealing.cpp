@@ -0,0 +1,77 @@
+#include "sealing.h"
+
+#include <TEE-Capability/common.h>
+
+#include "enclave_log.h"
+
+#include <cstring>
+
+#ifdef __TEE
+extern "C" {
+#include "secgear_random.h"
+}
+#else
+#include <random>
+#endif
+
+namespace {
+
+// the additional text common.h seals with, kept so that old records unseal
+const char SEAL_ADD_TEXT[] = "add mac text";
+const uint32_t SEAL_ADD_LEN = sizeof(SEAL_ADD_TEXT);
+
+}  // namespace
+
+int sealed_size(int data_len)
+{
+    uint32_t len = cc_enclave_get_sealed_data_size(SEAL_ADD_LEN, data_len);
+    return len == UINT32_MAX ? -1 : (int)len;
+}
+
+int seal_into(const void *data, int data_len, char *out, int out_len)
+{
+    int len = sealed_size(data_len);
+    if (len < 0 || len > out_len) {
+        LOG_ERROR("SEAL: SEALED DATA LEN > BUF LEN (%d > %d)\n", len, out_len);
+        return -1;
+    }
+
+    uint32_t ret = cc_enclave_seal_data(
+        (uint8_t *)data, data_len, (cc_enclave_sealed_data_t *)out, len,
+        (uint8_t *)SEAL_ADD_TEXT, SEAL_ADD_LEN);
+    return ret == 0 ? len : -1;
+}
+
+int unseal_into(const char *sealed, int sealed_len, void *out, int out_len)
+{
+    if (sealed_len < (int)sizeof(cc_enclave_sealed_data_t)) return -1;
+    const cc_enclave_sealed_data_t *blob =
+        (const cc_enclave_sealed_data_t *)sealed;
+
+    uint32_t add_len = cc_enclave_get_add_text_size(blob);
+    uint32_t data_len = cc_enclave_get_encrypted_text_size(blob);
+    if (add_len != SEAL_ADD_LEN || data_len > (uint32_t)out_len) return -1;
+    if (sealed_size((int)data_len) > sealed_len) return -1;
+
+    char add_text[SEAL_ADD_LEN];
+    uint32_t ret = cc_enclave_unseal_data((cc_enclave_sealed_data_t *)sealed,
+                                          (uint8_t *)out, &data_len,
+                                          (uint8_t *)add_text, &add_len);
+    if (ret != 0 || add_len != SEAL_ADD_LEN ||
+        memcmp(add_text, SEAL_ADD_TEXT, SEAL_ADD_LEN) != 0) {
+        return -1;
+    }
+    return (int)data_len;
+}
+
+bool random_bytes(void *buf, size_t len)
+{
+#ifdef __TEE
+    return cc_enclave_generate_random(buf, len) == 0;
+#else
+    std::random_device rd;
+    unsigned char *p = (unsigned char *)buf;
+    for (size_t i = 0; i < len; i++) p[i] = (unsigned char)rd();
+    return true;
+#endif
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+
+// Platform sealing into caller provided buffers.
+//
+// seal_data_inplace and unseal_data_inplace of TEE-Capability/common.h copy
+// through heap buffers they never free, so every call leaks the size of the
+// record. These helpers seal and unseal straight between the caller's
+// buffers and allocate nothing. Blobs are compatible with the ones of
+// common.h in both directions.
+
+// bytes a blob sealed from data_len bytes takes
+int sealed_size(int data_len);
+
+// seal data_len bytes of data into out, which must not overlap data. returns
+// the sealed length, -1 if out_len is too small or sealing failed
+int seal_into(const void *data, int data_len, char *out, int out_len);
+
+// unseal the blob of sealed_len bytes into out. returns the plaintext length,
+// -1 if the blob is malformed, does not fit out_len or fails to unseal
+int unseal_into(const char *sealed, int sealed_len, void *out, int out_len);
+
+// len bytes from the enclave random number generator, false on failure
+bool random_bytes(void *buf, size_t len);
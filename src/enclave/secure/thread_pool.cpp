@@ -0,0 +1,128 @@
+#include "thread_pool.h"
+
+namespace {
+
+struct WorkerArg
+{
+    ThreadPool *pool;
+    int index;
+};
+
+ThreadPool *g_shared_pool = nullptr;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads)
+    : m_fn(nullptr),
+      m_ctx(nullptr),
+      m_n(0),
+      m_active(0),
+      m_busy(0),
+      m_generation(0),
+      m_running(false),
+      m_stop(false),
+      m_next(0)
+{
+    pthread_mutex_init(&m_mutex, nullptr);
+    pthread_cond_init(&m_work_cond, nullptr);
+    pthread_cond_init(&m_done_cond, nullptr);
+
+    for (int i = 0; i + 1 < num_threads; i++) {
+        WorkerArg *arg = new WorkerArg{this, i};
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, worker_main, arg) != 0) {
+            // no (more) threads in this runtime, run with what we have
+            delete arg;
+            break;
+        }
+        m_workers.push_back(thread);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    pthread_cond_broadcast(&m_work_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    for (pthread_t thread : m_workers) pthread_join(thread, nullptr);
+
+    pthread_cond_destroy(&m_done_cond);
+    pthread_cond_destroy(&m_work_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void ThreadPool::run_tasks()
+{
+    for (;;) {
+        int i = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= m_n) break;
+        m_fn(i, m_ctx);
+    }
+}
+
+void *ThreadPool::worker_main(void *arg)
+{
+    WorkerArg *worker = (WorkerArg *)arg;
+    ThreadPool *pool = worker->pool;
+    const int index = worker->index;
+    delete worker;
+
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->m_mutex);
+    for (;;) {
+        while (!pool->m_stop && pool->m_generation == seen) {
+            pthread_cond_wait(&pool->m_work_cond, &pool->m_mutex);
+        }
+        if (pool->m_stop) break;
+        seen = pool->m_generation;
+
+        if (index < pool->m_active) {
+            pthread_mutex_unlock(&pool->m_mutex);
+            pool->run_tasks();
+            pthread_mutex_lock(&pool->m_mutex);
+            if (--pool->m_busy == 0) pthread_cond_signal(&pool->m_done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->m_mutex);
+    return nullptr;
+}
+
+void ThreadPool::parallel_for(int n, int max_threads, task_func fn, void *ctx)
+{
+    int active = max_threads - 1;
+    if (active > (int)m_workers.size()) active = (int)m_workers.size();
+    if (active > n - 1) active = n - 1;
+
+    pthread_mutex_lock(&m_mutex);
+    if (active <= 0 || m_running) {
+        pthread_mutex_unlock(&m_mutex);
+        for (int i = 0; i < n; i++) fn(i, ctx);
+        return;
+    }
+    m_fn = fn;
+    m_ctx = ctx;
+    m_n = n;
+    m_active = active;
+    m_busy = active;
+    m_next.store(0, std::memory_order_relaxed);
+    m_running = true;
+    m_generation++;
+    pthread_cond_broadcast(&m_work_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    run_tasks();
+
+    pthread_mutex_lock(&m_mutex);
+    while (m_busy > 0) pthread_cond_wait(&m_done_cond, &m_mutex);
+    m_running = false;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+void init_shared_thread_pool(int num_threads)
+{
+    if (!g_shared_pool) g_shared_pool = new ThreadPool(num_threads);
+}
+
+ThreadPool *shared_thread_pool() { return g_shared_pool; }
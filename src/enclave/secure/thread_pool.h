@@ -0,0 +1,63 @@
+#pragma once
+#include <pthread.h>
+
+#include <atomic>
+#include <vector>
+
+// Fixed set of worker threads running the iterations of one parallel loop at a
+// time, the calling thread takes part in every loop.
+//
+// The enclave ncnn is built without OpenMP and simpleomp, so its own
+// "#pragma omp parallel for" loops always run on one hart. The enclave layers
+// of rvv_layers.h split their channel loops over this pool instead, bounded by
+// opt.num_threads.
+//
+// Workers are plain pthreads. When the runtime cannot start them (a Penglai
+// enclave owns a single hart) the pool has no workers and every loop runs
+// inline on the caller. A loop started from inside a running loop also runs
+// inline.
+class ThreadPool
+{
+   public:
+    typedef void (*task_func)(int i, void *ctx);
+
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    // threads taking part in a loop, including the caller
+    int num_threads() const { return (int)m_workers.size() + 1; }
+
+    // run fn(i, ctx) for every i in [0, n) on at most max_threads threads
+    void parallel_for(int n, int max_threads, task_func fn, void *ctx);
+
+    template <typename Fn>
+    void parallel_for(int n, int max_threads, Fn &fn)
+    {
+        parallel_for(
+            n, max_threads, [](int i, void *ctx) { (*(Fn *)ctx)(i); }, &fn);
+    }
+
+   private:
+    static void *worker_main(void *arg);
+    void run_tasks();
+
+    std::vector<pthread_t> m_workers;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_work_cond;
+    pthread_cond_t m_done_cond;
+
+    // current loop, guarded by m_mutex except m_next
+    task_func m_fn;
+    void *m_ctx;
+    int m_n;
+    int m_active;        // workers allowed to take part in the loop
+    int m_busy;          // workers that have not finished the loop yet
+    unsigned m_generation;
+    bool m_running;
+    bool m_stop;
+    std::atomic<int> m_next;
+};
+
+// pool shared by the enclave layers, null until init_shared_thread_pool
+void init_shared_thread_pool(int num_threads);
+ThreadPool *shared_thread_pool();
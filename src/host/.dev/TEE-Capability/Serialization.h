@@ -33,6 +33,10 @@ public:
     m_curpos = 0;
     insert(begin(), in, in + len);
   }
+  StreamBuffer(const StreamBuffer &) = default;
+  StreamBuffer(StreamBuffer &&) = default;
+  StreamBuffer &operator=(const StreamBuffer &) = default;
+  StreamBuffer &operator=(StreamBuffer &&) = default;
   ~StreamBuffer() {}
 
   void reset() { m_curpos = 0; }
@@ -66,7 +70,8 @@ public:
 
   Serialization(StreamBuffer dev, int byteorder = LittleEndian) {
     m_byteorder = byteorder;
-    m_iodevice = dev;
+    // moved, the stream of a received call holds the whole payload
+    m_iodevice = std::move(dev);
   }
 
 public:
@@ -96,6 +101,12 @@ public:
 
   template <typename T> void input_type(T t);
 
+  // buffers are written straight from the caller's object, without the copy
+  // a by-value parameter would take
+  void input_type(const std::vector<char> &in);
+
+  void input_type(const PackedMigrateCallResult &in);
+
   template <typename T, size_t N> void input_type(T (&t)[N]) {
     std::cout << "OK" << std::endl;
     int len = sizeof(T) * N;
@@ -222,7 +233,7 @@ template <> inline void Serialization::input_type(std::string in) {
   delete[] d;
 }
 
-template <> inline void Serialization::input_type(std::vector<char> in) {
+inline void Serialization::input_type(const std::vector<char> &in) {
   // store the string length first
   length_t len = in.size();
   char *p = reinterpret_cast<char *>(&len);
@@ -234,7 +245,7 @@ template <> inline void Serialization::input_type(std::vector<char> in) {
   m_iodevice.input((char *)in.data(), len);
 }
 
-template <> inline void Serialization::input_type(PackedMigrateCallResult in) {
+inline void Serialization::input_type(const PackedMigrateCallResult &in) {
   input_type(in.res);
   input_type(in.out_buf);
 }
@@ -66,10 +66,19 @@ public:
     }
     return in;
   }
-  friend Serialization &operator<<(Serialization &out, value_t<T> d) {
+  // by reference, so that the payload is not copied. every value category
+  // needs its own overload, Serialization's member operator<< would
+  // otherwise be the better match and write value_t as raw bytes
+  friend Serialization &operator<<(Serialization &out, const value_t<T> &d) {
     out << d.code_ << d.msg_ << d.val_;
     return out;
   }
+  friend Serialization &operator<<(Serialization &out, value_t<T> &d) {
+    return out << static_cast<const value_t<T> &>(d);
+  }
+  friend Serialization &operator<<(Serialization &out, value_t<T> &&d) {
+    return out << static_cast<const value_t<T> &>(d);
+  }
 
 private:
   code_type code_;
@@ -113,16 +122,16 @@ public:
   template <typename R, typename F, typename ArgsTuple>
   typename std::enable_if<std::is_same<R, void>::value,
                           typename type_xx<R>::type>::type
-  call_helper(F f, ArgsTuple args) {
-    invoke(f, args);
+  call_helper(F &f, ArgsTuple &&args) {
+    invoke(f, std::move(args));
     return 0;
   }
 
   template <typename R, typename F, typename ArgsTuple>
   typename std::enable_if<!std::is_same<R, void>::value,
                           typename type_xx<R>::type>::type
-  call_helper(F f, ArgsTuple args) {
-    return invoke(f, args);
+  call_helper(F &f, ArgsTuple &&args) {
+    return invoke(f, std::move(args));
   }
 
   template <typename R, typename... Params>
@@ -136,7 +145,8 @@ public:
     args_type args =
         param_serialization.get_tuple<args_type>(std::make_index_sequence<N>{});
 
-    typename type_xx<R>::type r = call_helper<R>(service, args);
+    // moved, so that by-value buffer parameters do not copy the payload
+    typename type_xx<R>::type r = call_helper<R>(service, std::move(args));
     (*serialization) << r;
   }
 
@@ -142,8 +142,10 @@ inline int seal_data_inplace(char *buf, int buf_len, int data_len) {
   ret = cc_enclave_seal_data((uint8_t *)plaintext, data_len, sealed_data,
                              sealed_data_len, (uint8_t *)additional_text,
                              add_len);
-  memcpy(buf, (const char *)sealed_data, sealed_data_len);
-  return sealed_data_len;
+  if (ret == 0)
+    memcpy(buf, (const char *)sealed_data, sealed_data_len);
+  free(sealed_data);
+  return ret == 0 ? (int)sealed_data_len : -1;
 }
 
 inline int unseal_data_inplace(char *buf, int buf_len) {
@@ -155,16 +157,24 @@ inline int unseal_data_inplace(char *buf, int buf_len) {
 
   char *decrypted_data = (char *)malloc(data_len);
   char *demac_data = (char *)malloc(add_len);
+  if (decrypted_data == NULL || demac_data == NULL) {
+    free(decrypted_data);
+    free(demac_data);
+    return -1;
+  }
 
   cc_enclave_unseal_data((cc_enclave_sealed_data_t *)sealed_data,
                          (uint8_t *)decrypted_data, &data_len,
                          (uint8_t *)demac_data, &add_len);
 
-  if (strcmp(demac_data, additional_text) != 0) {
-    return -1;
+  int ret = -1;
+  if (add_len == sizeof(additional_text) &&
+      memcmp(demac_data, additional_text, add_len) == 0) {
+    memcpy(buf, decrypted_data, data_len);
+    ret = data_len;
   }
-
-  memcpy(buf, decrypted_data, data_len);
-  return data_len;
+  free(decrypted_data);
+  free(demac_data);
+  return ret;
 }
 } // namespace
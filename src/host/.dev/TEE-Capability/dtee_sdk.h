@@ -31,7 +31,7 @@ inline PackedMigrateCallResult _Z_task_handler(std::string enclave_name,
   int res = ecall_proxy(enclave_filename.c_str(), function_id, in_buf.data(),
                         in_buf.size(), out_buf.data(), out_buf.size());
   std::cout << "ECALL RES: " << res << std::endl;
-  PackedMigrateCallResult result = {.res = res, .out_buf = out_buf};
+  PackedMigrateCallResult result = {.res = res, .out_buf = std::move(out_buf)};
   return result;
 }
 
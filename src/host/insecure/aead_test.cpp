@@ -0,0 +1,95 @@
+#include <cstring>
+#include <vector>
+
+#include "../../enclave/secure/aead.h"
+#include "catch.hpp"
+
+namespace {
+
+// RFC 8439, section 2.8.2
+const uint8_t RFC_KEY[AEAD_KEY_SIZE] = {
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a,
+    0x8b, 0x8c, 0x8d, 0x8e, 0x8f, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95,
+    0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f};
+
+const uint8_t RFC_NONCE[AEAD_NONCE_SIZE] = {0x07, 0x00, 0x00, 0x00,
+                                            0x40, 0x41, 0x42, 0x43,
+                                            0x44, 0x45, 0x46, 0x47};
+
+const uint8_t RFC_AAD[] = {0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1,
+                           0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7};
+
+const char RFC_PLAINTEXT[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only "
+    "one tip for the future, sunscreen would be it.";
+
+const uint8_t RFC_CIPHERTEXT[] = {
+    0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc,
+    0x53, 0xef, 0x7e, 0xc2, 0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe,
+    0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6, 0x3d, 0xbe, 0xa4, 0x5e,
+    0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+    0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6,
+    0x7e, 0xcd, 0x3b, 0x36, 0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c,
+    0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58, 0xfa, 0xb3, 0x24, 0xe4,
+    0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+    0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65,
+    0x86, 0xce, 0xc6, 0x4b, 0x61, 0x16};
+
+const uint8_t RFC_TAG[AEAD_TAG_SIZE] = {0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09,
+                                        0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb,
+                                        0xd0, 0x60, 0x06, 0x91};
+
+const size_t RFC_LEN = sizeof(RFC_PLAINTEXT) - 1;
+
+}  // namespace
+
+TEST_CASE("ChaCha20-Poly1305 matches the RFC 8439 vector", "[aead]")
+{
+    REQUIRE(RFC_LEN == sizeof(RFC_CIPHERTEXT));
+
+    std::vector<uint8_t> data(RFC_PLAINTEXT, RFC_PLAINTEXT + RFC_LEN);
+    uint8_t tag[AEAD_TAG_SIZE];
+    aead_encrypt(RFC_KEY, RFC_NONCE, RFC_AAD, sizeof(RFC_AAD), data.data(),
+                 data.size(), tag);
+    REQUIRE(memcmp(data.data(), RFC_CIPHERTEXT, RFC_LEN) == 0);
+    REQUIRE(memcmp(tag, RFC_TAG, AEAD_TAG_SIZE) == 0);
+
+    REQUIRE(aead_decrypt(RFC_KEY, RFC_NONCE, RFC_AAD, sizeof(RFC_AAD),
+                         data.data(), data.size(), tag));
+    REQUIRE(memcmp(data.data(), RFC_PLAINTEXT, RFC_LEN) == 0);
+}
+
+TEST_CASE("ChaCha20-Poly1305 rejects modified input", "[aead]")
+{
+    std::vector<uint8_t> data(RFC_CIPHERTEXT,
+                              RFC_CIPHERTEXT + sizeof(RFC_CIPHERTEXT));
+    uint8_t tag[AEAD_TAG_SIZE];
+    memcpy(tag, RFC_TAG, AEAD_TAG_SIZE);
+
+    SECTION("tag")
+    {
+        tag[AEAD_TAG_SIZE - 1] ^= 1;
+        REQUIRE_FALSE(aead_decrypt(RFC_KEY, RFC_NONCE, RFC_AAD,
+                                   sizeof(RFC_AAD), data.data(), data.size(),
+                                   tag));
+    }
+    SECTION("ciphertext")
+    {
+        data[0] ^= 1;
+        REQUIRE_FALSE(aead_decrypt(RFC_KEY, RFC_NONCE, RFC_AAD,
+                                   sizeof(RFC_AAD), data.data(), data.size(),
+                                   tag));
+        data[0] ^= 1;
+    }
+    SECTION("aad")
+    {
+        uint8_t aad[sizeof(RFC_AAD)];
+        memcpy(aad, RFC_AAD, sizeof(aad));
+        aad[0] ^= 1;
+        REQUIRE_FALSE(aead_decrypt(RFC_KEY, RFC_NONCE, aad, sizeof(aad),
+                                   data.data(), data.size(), tag));
+    }
+
+    // a rejected ciphertext is left as it was
+    REQUIRE(memcmp(data.data(), RFC_CIPHERTEXT, sizeof(RFC_CIPHERTEXT)) == 0);
+}
@@ -24,7 +24,15 @@ int main(int argc, char **argv)
 {
     (void)read_file;
     (void)write_file;
-    (void)get_emb_list;
+    (void)list_records;
+    (void)write_files;
+    (void)write_profile;
+    (void)write_log;
+    (void)read_file_at;
+    (void)write_file_at;
+    (void)prefetch_file;
+    (void)fetch_prefetched;
+    (void)read_records;
     CLI::App app{"face recognition client cli"};
     app.require_subcommand(1);
 
@@ -35,6 +43,22 @@ int main(int argc, char **argv)
         ->required();
     record->add_option("person_id", person_id, "Person ID")->required();
 
+    auto record_batch = app.add_subcommand(
+        "record-batch", "Record many people, ids increase from first_person_id");
+    std::vector<std::string> batch_img_paths;
+    int first_person_id;
+    record_batch
+        ->add_option("first_person_id", first_person_id, "ID of the first person")
+        ->required();
+    record_batch
+        ->add_option("img_paths", batch_img_paths, "Paths to the image files")
+        ->required();
+
+    auto train_pq = app.add_subcommand(
+        "train-pq", "Train the gallery product quantizer on recorded people");
+    int pq_iters = 10;
+    train_pq->add_option("iters", pq_iters, "K-means iterations");
+
     auto verify = app.add_subcommand("verify", "Verify a person");
     std::string img_to_verify_path;
     verify
@@ -54,6 +78,48 @@ int main(int argc, char **argv)
         int res = img_recorder((char*)image_data, person_id);
         printf("Record successfully. Embedding length: %d\n", res);
     }
+    else if (*record_batch) {
+        // at most MAX_BATCH_CNT faces go into the enclave per call
+        std::vector<char> imgs(MAX_BATCH_CNT * IMG_SIZE);
+        std::vector<int> ids, status(MAX_BATCH_CNT);
+        int total = (int)batch_img_paths.size(), recorded = 0;
+        for (int i = 0; i < total; i++) {
+            printf("Recording: %s with person ID: %d\n",
+                   batch_img_paths[i].c_str(), first_person_id + i);
+            auto image_data = detect_face_and_load(batch_img_paths[i].c_str());
+            if (image_data != NULL) {
+                memcpy(imgs.data() + ids.size() * IMG_SIZE, image_data,
+                       IMG_SIZE);
+                stbi_image_free(image_data);
+                ids.push_back(first_person_id + i);
+            }
+
+            bool flush = (int)ids.size() == MAX_BATCH_CNT || i == total - 1;
+            if (flush && !ids.empty()) {
+                int res = img_recorder_batch(
+                    imgs.data(), (int)ids.size() * IMG_SIZE, (char*)ids.data(),
+                    (int)(ids.size() * sizeof(int)), (char*)status.data(),
+                    (int)(ids.size() * sizeof(int)));
+                for (size_t j = 0; res >= 0 && j < ids.size(); j++) {
+                    if (status[j] < 0) {
+                        printf("Fail to record person ID: %d\n", ids[j]);
+                    }
+                }
+                recorded += res > 0 ? res : 0;
+                ids.clear();
+            }
+        }
+        printf("Record %d/%d faces successfully.\n", recorded, total);
+    }
+    else if (*train_pq) {
+        int res = pq_train(pq_iters);
+        if (res < 0) {
+            printf("Fail to train the product quantizer\n");
+        }
+        else {
+            printf("Product quantizer trained on %d faces\n", res);
+        }
+    }
     else if (*verify) {
         printf("Verifying: %s", img_to_verify_path.c_str());
         auto image_data = detect_face_and_load(img_to_verify_path.c_str());
@@ -66,5 +132,6 @@ int main(int argc, char **argv)
         }
     }
 
+    z_shutdown_enclave();
     destroy_distributed_tee_context(ctx);
 }
@@ -1,11 +1,21 @@
 #include "TEE-Capability/dtee_sdk.h"
 #include "file.h"
+#include "../secure/embedding.h"
 int main() {
   (void)write_file;
-  (void)get_emb_list;
+  (void)list_records;
   (void)read_file;
+  (void)write_files;
+  (void)write_profile;
+  (void)write_log;
+  (void)read_file_at;
+  (void)write_file_at;
+  (void)prefetch_file;
+  (void)fetch_prefetched;
+  (void)read_records;
   auto ctx = init_distributed_tee_context(
       {.side = SIDE::Server, .mode = MODE::ComputeNode});
   dtee_server_run(ctx);
+  z_shutdown_enclave();
   destroy_distributed_tee_context(ctx);
 }
@@ -1,60 +1,193 @@
 
 
 #define write_file __insecure_write_file_impl
-#define get_emb_list __insecure_get_emb_list_impl
+#define list_records __insecure_list_records_impl
 #define read_file __insecure_read_file_impl
+#define write_files __insecure_write_files_impl
+#define write_profile __insecure_write_profile_impl
+#define write_log __insecure_write_log_impl
+#define read_file_at __insecure_read_file_at_impl
+#define write_file_at __insecure_write_file_at_impl
+#define prefetch_file __insecure_prefetch_file_impl
+#define fetch_prefetched __insecure_fetch_prefetched_impl
+#define read_records __insecure_read_records_impl
 
 #include "file.h"
+#include "record_store.h"
 
-#include <filesystem>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <regex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 extern "C" int write_file(in_char* in_filename, int in_filename_len, in_char* in_content, int in_content_len)
 {
-    std::string filename = in_filename;
+    std::string filename(in_filename, strnlen(in_filename, in_filename_len));
+    int id = record_file_id(filename);
+    if (id >= 0) {
+        return RecordStore::instance().append(id, in_content, in_content_len) ? 0 : -1;
+    }
     std::ofstream ofs(filename);
     ofs.write(in_content,in_content_len);
     return 0;
 }
 
-extern "C" int get_emb_list(char out_list[sizeof(int) * MAX_EMB_CNT])
+extern "C" int list_records(int cursor, char* out_ids, int out_ids_len)
 {
-    int cnt = 0;
-    int* p_list = (int*)out_list;
+    return RecordStore::instance().list(cursor, (int*)out_ids, out_ids_len / (int)sizeof(int));
+}
 
-    std::vector<int> ids;
+extern "C" int read_records(int cursor, char* out_records, int out_records_len)
+{
+    return RecordStore::instance().read_batch(cursor, out_records, out_records_len);
+}
 
-    for (const auto& e : std::filesystem::directory_iterator(".")) {
-        const auto& path = e.path();
-        const auto path_str = path.string();
-        // if path_str belike "emb*.bin", take its id
-        std::regex re("emb(\\d+)\\.bin");
-        if (std::regex_search(path_str, re)) {
-            std::smatch match;
-            std::regex_search(path_str, match, re);
-            int id = std::stoi(match[1]);
-            ids.push_back(id);
+extern "C" int read_file(char* in_filename, int in_filename_len, char* out_content, int out_content_len) {
+    std::string filename(in_filename, strnlen(in_filename, in_filename_len));
+    int id = record_file_id(filename);
+    if (id >= 0) {
+        return RecordStore::instance().get(id, out_content, out_content_len) < 0 ? -1 : 0;
+    }
+	std::ifstream ifs(filename, std::ios::binary);
+	ifs.read(out_content, out_content_len);
+	return 0;
+}
 
-            if (ids.size() >= MAX_EMB_CNT) {
-                break;
-            }
+extern "C" int write_files(char* in_ids, int in_ids_len, char* in_contents, int in_contents_len)
+{
+    int cnt = in_ids_len / sizeof(int);
+    if (cnt <= 0) {
+        return 0;
+    }
+    // records are packed back to back with the same length
+    int record_len = in_contents_len / cnt;
+    int written = 0;
+    for (int i = 0; i < cnt; i++) {
+        int id;
+        memcpy(&id, in_ids + i * sizeof(int), sizeof(int));
+        if (RecordStore::instance().append(id, in_contents + i * record_len, record_len)) {
+            written++;
         }
     }
+    return written;
+}
 
-    std::sort(ids.begin(), ids.end());
-    for (const auto id  : ids) {
-        p_list[cnt++] = id;
-    }
+extern "C" int write_profile(char* in_trace, int in_trace_len)
+{
+    // one trace per request, appended
+    std::ofstream ofs("profile.bin", std::ios::binary | std::ios::app);
+    ofs.write(in_trace, in_trace_len);
+    return ofs.good() ? 0 : -1;
+}
 
-    return cnt;
+extern "C" int write_log(char* in_log, int in_log_len)
+{
+    fwrite(in_log, 1, in_log_len, stdout);
+    fflush(stdout);
+    return 0;
 }
 
-extern "C" int read_file(char* in_filename, int in_filename_len, char* out_content, int out_content_len) {
-    std::string filename(in_filename, in_filename + in_filename_len);
-	std::ifstream ifs(filename, std::ios::binary);
-	ifs.read(out_content, out_content_len);
-	return 0;
+extern "C" int read_file_at(char* in_filename, int in_filename_len, int64_t offset, char* out_content, int out_content_len)
+{
+    std::string filename(in_filename, strnlen(in_filename, in_filename_len));
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs) {
+        struct stat st;
+        return stat(filename.c_str(), &st) != 0 && errno == ENOENT ? FILE_NOT_FOUND : -1;
+    }
+    ifs.seekg(offset);
+    ifs.read(out_content, out_content_len);
+    return (int)ifs.gcount();
+}
+
+extern "C" int write_file_at(char* in_filename, int in_filename_len, int64_t offset, char* in_content, int in_content_len)
+{
+    std::string filename(in_filename, strnlen(in_filename, in_filename_len));
+    std::fstream fs(filename, std::ios::binary | std::ios::in | std::ios::out);
+    if (!fs) {
+        // in | out does not create the file
+        std::ofstream(filename, std::ios::binary);
+        fs.open(filename, std::ios::binary | std::ios::in | std::ios::out);
+    }
+    if (!fs) {
+        return -1;
+    }
+    fs.seekp(offset);
+    fs.write(in_content, in_content_len);
+    return fs.good() ? in_content_len : -1;
 }
 
+namespace {
+
+// a read prefetch_file started, kept until fetch_prefetched takes it
+struct PrefetchSlot
+{
+    std::thread reader;
+    std::vector<char> buf;
+    int len = -1;
+};
+
+// pending reads of every enclave, by the handle the enclave passed
+std::mutex g_prefetch_mutex;
+std::map<int, std::unique_ptr<PrefetchSlot>> g_prefetch;
+
+// bounds the untrusted memory of reads nobody fetches
+const size_t PREFETCH_MAX_PENDING = 64;
+
+}  // namespace
+
+extern "C" int prefetch_file(char* in_filename, int in_filename_len, int64_t offset, int len, int handle)
+{
+    if (len < 0) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(g_prefetch_mutex);
+    if (g_prefetch.count(handle) || g_prefetch.size() >= PREFETCH_MAX_PENDING) {
+        return -1;
+    }
+
+    std::string filename(in_filename, strnlen(in_filename, in_filename_len));
+    std::unique_ptr<PrefetchSlot> slot(new PrefetchSlot);
+    PrefetchSlot* s = slot.get();
+    s->buf.resize(len);
+    s->reader = std::thread([s, filename, offset, len]() {
+        std::ifstream ifs(filename, std::ios::binary);
+        if (!ifs) {
+            return;
+        }
+        ifs.seekg(offset);
+        ifs.read(s->buf.data(), len);
+        s->len = (int)ifs.gcount();
+    });
+    g_prefetch.emplace(handle, std::move(slot));
+    return 0;
+}
 
+extern "C" int fetch_prefetched(int handle, char* out_content, int out_content_len)
+{
+    std::unique_ptr<PrefetchSlot> s;
+    {
+        std::lock_guard<std::mutex> lock(g_prefetch_mutex);
+        auto it = g_prefetch.find(handle);
+        if (it == g_prefetch.end()) {
+            return -1;
+        }
+        s = std::move(it->second);
+        g_prefetch.erase(it);
+    }
+    s->reader.join();
+    if (s->len < 0) {
+        return -1;
+    }
+    int len = std::min(s->len, out_content_len);
+    memcpy(out_content, s->buf.data(), len);
+    return len;
+}
@@ -1,11 +1,39 @@
 #pragma once
+#include <stdint.h>
 // #include "../secure/embedding.h"
-#define MAX_EMB_CNT 10000
 typedef char in_char;
 typedef char out_char;
 extern "C" int write_file(in_char* in_filename, int in_filename_len, in_char* in_content, int in_content_len);
-extern "C" int get_emb_list(char out_list[sizeof(int) * MAX_EMB_CNT]);
+// one page of the ids of the stored emb<id>.bin records: the ids >= cursor in
+// ascending order, as many as fit in out_ids. returns the number written, the
+// next page starts at the last id + 1
+extern "C" int list_records(int cursor, char* out_ids, int out_ids_len);
 extern "C" int read_file(char* in_filename, int in_filename_len, char* out_content, int out_content_len);
+extern "C" int write_files(char* in_ids, int in_ids_len, char* in_contents, int in_contents_len);
+extern "C" int write_profile(char* in_trace, int in_trace_len);
+extern "C" int write_log(char* in_log, int in_log_len);
+// positioned reads and writes at 64 bit offsets, both return the number of
+// bytes transferred or -1 if the file cannot be opened. read_file_at returns
+// FILE_NOT_FOUND instead if the file does not exist, write_file_at creates it
+#define FILE_NOT_FOUND (-2)
+extern "C" int read_file_at(char* in_filename, int in_filename_len, int64_t offset, char* out_content, int out_content_len);
+extern "C" int write_file_at(char* in_filename, int in_filename_len, int64_t offset, char* in_content, int in_content_len);
+// asynchronous reads into untrusted buffers of the host: prefetch_file
+// starts reading len bytes at offset under handle and returns at once, or -1
+// if a read under handle is still pending. fetch_prefetched waits for that
+// read, copies it out and frees the handle, returning the number of bytes
+// read or -1. handles are chosen by the caller and must not be shared with
+// other callers, PREFETCH_SLOTS reads are kept in flight by one caller
+#define PREFETCH_SLOTS 2
+extern "C" int prefetch_file(char* in_filename, int in_filename_len, int64_t offset, int len, int handle);
+extern "C" int fetch_prefetched(int handle, char* out_content, int out_content_len);
+// bulk read of the stored emb<id>.bin records with ids >= cursor, in id
+// order. out_records receives an int count and then count entries of an
+// int id, an int len and the len byte record. the count and every entry are
+// padded to RECORD_ENTRY_ALIGN bytes. returns the cursor to continue from, a
+// count of 0 means every record has been read
+#define RECORD_ENTRY_ALIGN 8
+extern "C" int read_records(int cursor, char* out_records, int out_records_len);
 
 // int img_recorder(std::array<char, IMG_SIZE> arr, int id);
 //
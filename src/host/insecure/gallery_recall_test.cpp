@@ -0,0 +1,168 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "../../enclave/secure/ivf_index.h"
+#include "../../enclave/secure/pq_codec.h"
+#include "catch.hpp"
+
+namespace {
+
+const int DIM = 128;
+const int GALLERY_SIZE = 4000;
+const int CLUSTERS = 64;
+const int QUERIES = 200;
+// candidates re-ranked on the float vectors, GALLERY_RERANK_K of the enclave
+const int RERANK_K = 8;
+// PQ sub-quantizers, 8 dims and one byte each
+const int PQ_M = 16;
+
+// enrolled faces scattered around CLUSTERS centers, and probes that are
+// copies of random enrolled faces moved by as much again, like a second
+// capture of an enrolled person
+struct Synthetic
+{
+    std::vector<float> gallery;
+    std::vector<float> queries;
+    // exhaustive float nearest neighbour of every query
+    std::vector<int> truth;
+
+    Synthetic()
+    {
+        std::mt19937 rng(2024);
+        std::normal_distribution<float> center(0.f, 1.f);
+        std::normal_distribution<float> spread(0.f, 0.3f);
+
+        std::vector<float> centers(CLUSTERS * DIM);
+        for (float &c : centers) c = center(rng);
+        gallery.resize(GALLERY_SIZE * DIM);
+        for (int i = 0; i < GALLERY_SIZE; i++) {
+            const float *c = centers.data() + (i % CLUSTERS) * DIM;
+            for (int d = 0; d < DIM; d++) {
+                gallery[i * DIM + d] = c[d] + spread(rng);
+            }
+        }
+
+        std::uniform_int_distribution<int> pick(0, GALLERY_SIZE - 1);
+        queries.resize(QUERIES * DIM);
+        truth.resize(QUERIES);
+        for (int q = 0; q < QUERIES; q++) {
+            const float *v = row(pick(rng));
+            for (int d = 0; d < DIM; d++) {
+                queries[q * DIM + d] = v[d] + spread(rng);
+            }
+            truth[q] = exact_nearest(query(q), nullptr, GALLERY_SIZE);
+        }
+    }
+
+    const float *row(int id) const { return gallery.data() + id * DIM; }
+    const float *query(int q) const { return queries.data() + q * DIM; }
+
+    float l2(const float *a, const float *b) const
+    {
+        float sum = 0.f;
+        for (int d = 0; d < DIM; d++) sum += (a[d] - b[d]) * (a[d] - b[d]);
+        return sum;
+    }
+
+    // nearest of ids[0..n), or of the first n rows if ids is null
+    int exact_nearest(const float *probe, const int *ids, int n) const
+    {
+        int best = -1;
+        float best_dist = 0.f;
+        for (int i = 0; i < n; i++) {
+            const int id = ids ? ids[i] : i;
+            const float dist = l2(probe, row(id));
+            if (best < 0 || dist < best_dist) {
+                best = id;
+                best_dist = dist;
+            }
+        }
+        return best;
+    }
+};
+
+const Synthetic &synthetic()
+{
+    static const Synthetic data;
+    return data;
+}
+
+void fill(IvfIndex &index)
+{
+    const Synthetic &data = synthetic();
+    for (int i = 0; i < GALLERY_SIZE; i++) index.add(i, data.row(i));
+}
+
+// share of queries whose nearest neighbour is found, with the rerank_k best
+// candidates re-ranked on the float vectors as Gallery::nearest does
+double recall_at_1(const IvfIndex &index, int nprobe, int rerank_k)
+{
+    const Synthetic &data = synthetic();
+    std::vector<int> ids(rerank_k);
+    std::vector<float> dists(rerank_k);
+    int hits = 0;
+    for (int q = 0; q < QUERIES; q++) {
+        int cnt = index.search(data.query(q), nprobe, rerank_k, ids.data(),
+                               dists.data());
+        if (cnt > 0 && data.exact_nearest(data.query(q), ids.data(), cnt) ==
+                           data.truth[q]) {
+            hits++;
+        }
+    }
+    return (double)hits / QUERIES;
+}
+
+}  // namespace
+
+TEST_CASE("IVF-Flat recall against the exhaustive search", "[gallery]")
+{
+    IvfIndex index(DIM, DISTANCE_L2);
+    fill(index);
+    const int nlist = (int)sqrtf((float)GALLERY_SIZE);
+    index.train(nlist, 10, 64 * nlist);
+    REQUIRE(index.nlist() == nlist);
+    REQUIRE(index.size() == GALLERY_SIZE);
+
+    // probing every list is exact
+    REQUIRE(recall_at_1(index, nlist, 1) == 1.0);
+    // GALLERY_IVF_NPROBE lists
+    CHECK(recall_at_1(index, 8, 1) >= 0.95);
+}
+
+TEST_CASE("Reduced precision storage with re-ranking keeps the nearest match",
+          "[gallery]")
+{
+    struct Case
+    {
+        const char *name;
+        VectorStorage storage;
+        // recall required without and with re-ranking
+        double raw;
+        double reranked;
+    };
+    const Case cases[] = {
+        {"fp16", STORAGE_FP16, 1.0, 1.0},
+        {"int8", STORAGE_INT8, 0.95, 1.0},
+        {"pq", STORAGE_PQ, 0.9, 0.99},
+    };
+    PqCodec codec(DIM, PQ_M);
+    codec.train(synthetic().gallery.data(), GALLERY_SIZE, 10);
+    REQUIRE(codec.trained());
+
+    for (const Case &c : cases) {
+        SECTION(c.name)
+        {
+            IvfIndex index(DIM, DISTANCE_L2, c.storage,
+                           c.storage == STORAGE_PQ ? &codec : nullptr);
+            fill(index);
+            // untrained, one list, so only the storage loses precision
+            CHECK(recall_at_1(index, 1, 1) >= c.raw);
+            CHECK(recall_at_1(index, 1, RERANK_K) >= c.reranked);
+
+            IvfIndex float_index(DIM, DISTANCE_L2);
+            fill(float_index);
+            CHECK(index.memory_bytes() < float_index.memory_bytes());
+        }
+    }
+}
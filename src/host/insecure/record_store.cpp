@@ -0,0 +1,253 @@
+#include "record_store.h"
+
+#include "file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+bool write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+uint64_t file_size(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+}  // namespace
+
+int record_file_id(const std::string& filename)
+{
+    const char* name = filename.c_str();
+    const char* slash = strrchr(name, '/');
+    if (slash) {
+        name = slash + 1;
+    }
+
+    int id, end = 0;
+    if (sscanf(name, "emb%d.bin%n", &id, &end) != 1 || end == 0 ||
+        name[end] != '\0' || id < 0) {
+        return -1;
+    }
+    return id;
+}
+
+RecordStore& RecordStore::instance()
+{
+    static RecordStore store(".");
+    return store;
+}
+
+RecordStore::RecordStore(const std::string& dir)
+    : m_data_fd(-1),
+      m_index_fd(-1),
+      m_data_size(0),
+      m_map(nullptr),
+      m_map_size(0)
+{
+    const std::string data_file = dir + "/" RECORD_DATA_FILE;
+    const std::string index_file = dir + "/" RECORD_INDEX_FILE;
+    m_data_fd = open(data_file.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+    m_index_fd = open(index_file.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (m_data_fd < 0 || m_index_fd < 0) {
+        printf("Fail to open %s\n", data_file.c_str());
+        return;
+    }
+    m_data_size = file_size(m_data_fd);
+    load_index();
+    if (m_index.empty()) {
+        import_files(dir);
+    }
+}
+
+RecordStore::~RecordStore()
+{
+    if (m_map) {
+        munmap((void*)m_map, m_map_size);
+    }
+    if (m_data_fd >= 0) {
+        close(m_data_fd);
+    }
+    if (m_index_fd >= 0) {
+        close(m_index_fd);
+    }
+}
+
+void RecordStore::load_index()
+{
+    uint64_t size = file_size(m_index_fd);
+    size_t cnt = size / sizeof(RecordIndexEntry);
+    if (size != cnt * sizeof(RecordIndexEntry)) {
+        // a torn entry at the end, later appends must stay aligned
+        size = cnt * sizeof(RecordIndexEntry);
+        if (ftruncate(m_index_fd, size) != 0) {
+            printf("Fail to repair %s\n", RECORD_INDEX_FILE);
+        }
+    }
+    if (cnt == 0) {
+        return;
+    }
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_index_fd, 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    const RecordIndexEntry* entries = (const RecordIndexEntry*)map;
+    for (size_t i = 0; i < cnt; i++) {
+        // an entry whose data never made it to the data file is dropped
+        if ((uint64_t)entries[i].offset + entries[i].len <= m_data_size) {
+            m_index[entries[i].id] = entries[i];
+        }
+    }
+    munmap(map, size);
+}
+
+void RecordStore::import_files(const std::string& dir)
+{
+    int cnt = 0;
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+        int id = record_file_id(e.path().filename().string());
+        if (id < 0) {
+            continue;
+        }
+        std::ifstream ifs(e.path(), std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(ifs)),
+                               std::istreambuf_iterator<char>());
+        if (append(id, data.data(), (int)data.size())) {
+            cnt++;
+        }
+    }
+    if (cnt > 0) {
+        printf("Imported %d records into %s\n", cnt, RECORD_DATA_FILE);
+    }
+}
+
+bool RecordStore::remap()
+{
+    if (m_map_size == m_data_size) {
+        return m_map != nullptr;
+    }
+    if (m_map) {
+        munmap((void*)m_map, m_map_size);
+        m_map = nullptr;
+        m_map_size = 0;
+    }
+    if (m_data_size == 0) {
+        return false;
+    }
+
+    void* map = mmap(nullptr, m_data_size, PROT_READ, MAP_SHARED, m_data_fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    m_map = (const char*)map;
+    m_map_size = m_data_size;
+    return true;
+}
+
+int RecordStore::count() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (int)m_index.size();
+}
+
+int RecordStore::list(int cursor, int* ids, int max) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int cnt = 0;
+    for (auto it = m_index.lower_bound(cursor); it != m_index.end() && cnt < max; ++it) {
+        ids[cnt++] = it->first;
+    }
+    return cnt;
+}
+
+int RecordStore::get(int id, char* out, int out_len)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(id);
+    if (it == m_index.end() || !remap()) {
+        return -1;
+    }
+    int len = (int)it->second.len;
+    memcpy(out, m_map + it->second.offset, std::min(len, out_len));
+    return len;
+}
+
+bool RecordStore::append(int id, const char* data, int len)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_data_fd < 0 || len < 0 || m_data_size + len > UINT32_MAX) {
+        return false;
+    }
+
+    // the data goes first, an index entry is only written for complete data
+    RecordIndexEntry entry = {id, (uint32_t)m_data_size, (uint32_t)len};
+    if (!write_all(m_data_fd, data, len)) {
+        m_data_size = file_size(m_data_fd);
+        return false;
+    }
+    m_data_size += len;
+    uint64_t index_size = file_size(m_index_fd);
+    if (!write_all(m_index_fd, &entry, sizeof(entry))) {
+        // drop a torn entry, or every later entry would be misaligned
+        if (ftruncate(m_index_fd, index_size) != 0) {
+            printf("Fail to repair %s\n", RECORD_INDEX_FILE);
+        }
+        return false;
+    }
+    m_index[id] = entry;
+    return true;
+}
+
+int RecordStore::read_batch(int cursor, char* out, int out_len)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int cnt = 0;
+    int pos = RECORD_ENTRY_ALIGN;
+    if (out_len < pos || !remap()) {
+        if (out_len >= (int)sizeof(int)) {
+            memcpy(out, &cnt, sizeof(int));
+        }
+        return cursor;
+    }
+
+    for (auto it = m_index.lower_bound(cursor); it != m_index.end(); ++it) {
+        const RecordIndexEntry& entry = it->second;
+        int entry_len = (int)(2 * sizeof(int) + entry.len + RECORD_ENTRY_ALIGN - 1) /
+                        RECORD_ENTRY_ALIGN * RECORD_ENTRY_ALIGN;
+        if (pos + entry_len > out_len) {
+            break;
+        }
+        int header[2] = {entry.id, (int)entry.len};
+        memcpy(out + pos, header, sizeof(header));
+        memcpy(out + pos + sizeof(header), m_map + entry.offset, entry.len);
+        pos += entry_len;
+        cursor = entry.id + 1;
+        cnt++;
+    }
+    memcpy(out, &cnt, sizeof(int));
+    return cursor;
+}
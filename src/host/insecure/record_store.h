@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Append-only store of the sealed face records.
+//
+// The records the enclave reads and writes as emb<id>.bin no longer get a
+// file each. They are appended to RECORD_DATA_FILE, and every append adds a
+// 12 byte (id, offset, len) entry to RECORD_INDEX_FILE. Both files are
+// memory-mapped. The latest entry of an id wins, so re-recording a face is
+// one more append. Enumeration and reads are served from the in-memory index
+// and the mapping, without directory scans or per-record opens.
+//
+// The first open of an empty store imports the emb<id>.bin files of the
+// store's directory once.
+#define RECORD_DATA_FILE "records.dat"
+#define RECORD_INDEX_FILE "records.idx"
+
+struct RecordIndexEntry
+{
+    int32_t id;
+    uint32_t offset;
+    uint32_t len;
+};
+
+class RecordStore
+{
+   public:
+    // the store of the working directory, opened on first use
+    static RecordStore& instance();
+
+    // open or create the store in dir
+    explicit RecordStore(const std::string& dir);
+    ~RecordStore();
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
+
+    int count() const;
+    // the first max ids >= cursor in ascending order, returns how many were
+    // written
+    int list(int cursor, int* ids, int max) const;
+    // copy up to out_len bytes of the stored record of id to out, returns
+    // the record length, -1 if there is none
+    int get(int id, char* out, int out_len);
+    bool append(int id, const char* data, int len);
+    // fill out with the records of ids >= cursor in the read_records layout
+    // of file.h, returns the cursor to continue from
+    int read_batch(int cursor, char* out, int out_len);
+
+   private:
+    void load_index();
+    void import_files(const std::string& dir);
+    // map the data file up to its current size, m_mutex held
+    bool remap();
+
+    int m_data_fd;
+    int m_index_fd;
+    uint64_t m_data_size;
+    const char* m_map;
+    uint64_t m_map_size;
+    // id -> latest entry
+    std::map<int, RecordIndexEntry> m_index;
+    // OCALLs come from several enclave threads, and an append may remap the
+    // data file under a reader
+    mutable std::mutex m_mutex;
+};
+
+// id of a record file name "emb<id>.bin", -1 for any other name
+int record_file_id(const std::string& filename);
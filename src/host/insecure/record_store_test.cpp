@@ -0,0 +1,191 @@
+#include <stdlib.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+#include "file.h"
+#include "record_store.h"
+
+namespace {
+
+// a fresh directory for one store, removed with everything in it
+struct TempDir
+{
+    std::string path;
+
+    TempDir()
+    {
+        char tmpl[] = "/tmp/record_store_test.XXXXXX";
+        REQUIRE(mkdtemp(tmpl) != nullptr);
+        path = tmpl;
+    }
+    ~TempDir() { std::filesystem::remove_all(path); }
+};
+
+std::string record_of(int id, int len)
+{
+    std::string data(len, '\0');
+    for (int i = 0; i < len; i++) data[i] = (char)(id * 31 + i);
+    return data;
+}
+
+std::string get_record(RecordStore &store, int id)
+{
+    std::vector<char> buf(256);
+    int len = store.get(id, buf.data(), (int)buf.size());
+    if (len < 0) return "<none>";
+    return std::string(buf.data(), std::min(len, (int)buf.size()));
+}
+
+// every record of the store read through read_batch with out_len byte pages
+std::map<int, std::string> read_all(RecordStore &store, int out_len,
+                                    int *pages)
+{
+    std::map<int, std::string> records;
+    std::vector<char> buf(out_len);
+    int cursor = 0;
+    *pages = 0;
+    for (;;) {
+        int next = store.read_batch(cursor, buf.data(), out_len);
+        int cnt;
+        memcpy(&cnt, buf.data(), sizeof(cnt));
+        if (cnt == 0) {
+            REQUIRE(next == cursor);
+            break;
+        }
+        REQUIRE(next > cursor);
+        (*pages)++;
+
+        int pos = RECORD_ENTRY_ALIGN;
+        for (int i = 0; i < cnt; i++) {
+            int header[2];
+            memcpy(header, buf.data() + pos, sizeof(header));
+            REQUIRE(header[0] >= cursor);
+            REQUIRE(header[0] < next);
+            records[header[0]] =
+                std::string(buf.data() + pos + sizeof(header), header[1]);
+            pos += ((int)sizeof(header) + header[1] + RECORD_ENTRY_ALIGN - 1) /
+                   RECORD_ENTRY_ALIGN * RECORD_ENTRY_ALIGN;
+            REQUIRE(pos <= out_len);
+        }
+        cursor = next;
+    }
+    return records;
+}
+
+}  // namespace
+
+TEST_CASE("RecordStore appends and reads records", "[record_store]")
+{
+    TempDir dir;
+    RecordStore store(dir.path);
+    REQUIRE(store.count() == 0);
+
+    REQUIRE(store.append(3, record_of(3, 40).data(), 40));
+    REQUIRE(store.append(1, record_of(1, 17).data(), 17));
+    REQUIRE(store.count() == 2);
+    REQUIRE(get_record(store, 3) == record_of(3, 40));
+    REQUIRE(get_record(store, 1) == record_of(1, 17));
+    REQUIRE(get_record(store, 2) == "<none>");
+
+    // the latest append of an id wins
+    REQUIRE(store.append(3, record_of(4, 24).data(), 24));
+    REQUIRE(store.count() == 2);
+    REQUIRE(get_record(store, 3) == record_of(4, 24));
+
+    // a short buffer gets a prefix, and the full length is returned
+    char prefix[8];
+    REQUIRE(store.get(3, prefix, sizeof(prefix)) == 24);
+    REQUIRE(std::string(prefix, sizeof(prefix)) ==
+            record_of(4, 24).substr(0, sizeof(prefix)));
+
+    int ids[4];
+    REQUIRE(store.list(0, ids, 4) == 2);
+    REQUIRE(ids[0] == 1);
+    REQUIRE(ids[1] == 3);
+    REQUIRE(store.list(2, ids, 4) == 1);
+    REQUIRE(ids[0] == 3);
+    REQUIRE(store.list(4, ids, 4) == 0);
+}
+
+TEST_CASE("RecordStore keeps its records across reopening", "[record_store]")
+{
+    TempDir dir;
+    {
+        RecordStore store(dir.path);
+        for (int id = 0; id < 10; id++) {
+            REQUIRE(store.append(id, record_of(id, 8 + id).data(), 8 + id));
+        }
+        REQUIRE(store.append(5, record_of(50, 30).data(), 30));
+    }
+
+    RecordStore store(dir.path);
+    REQUIRE(store.count() == 10);
+    for (int id = 0; id < 10; id++) {
+        const std::string expected =
+            id == 5 ? record_of(50, 30) : record_of(id, 8 + id);
+        REQUIRE(get_record(store, id) == expected);
+    }
+
+    // appends after reopening go on from the end of the data file
+    REQUIRE(store.append(10, record_of(10, 12).data(), 12));
+    REQUIRE(get_record(store, 10) == record_of(10, 12));
+    REQUIRE(get_record(store, 9) == record_of(9, 17));
+}
+
+TEST_CASE("RecordStore imports emb<id>.bin files once", "[record_store]")
+{
+    TempDir dir;
+    for (int id : {2, 7}) {
+        std::ofstream ofs(dir.path + "/emb" + std::to_string(id) + ".bin",
+                          std::ios::binary);
+        ofs << record_of(id, 20);
+    }
+    std::ofstream(dir.path + "/other.bin") << "not a record";
+
+    RecordStore store(dir.path);
+    REQUIRE(store.count() == 2);
+    REQUIRE(get_record(store, 2) == record_of(2, 20));
+    REQUIRE(get_record(store, 7) == record_of(7, 20));
+}
+
+TEST_CASE("RecordStore pages through the records with a cursor",
+          "[record_store]")
+{
+    TempDir dir;
+    RecordStore store(dir.path);
+
+    int pages = 0;
+    std::map<int, std::string> expected;
+    REQUIRE(read_all(store, 256, &pages).empty());
+    REQUIRE(pages == 0);
+
+    // ids with gaps, records of different lengths
+    for (int i = 0; i < 50; i++) {
+        const int id = i * 3;
+        const int len = 1 + i % 13;
+        expected[id] = record_of(id, len);
+        REQUIRE(store.append(id, expected[id].data(), len));
+    }
+
+    // a small page holds a few records, a large one all of them
+    REQUIRE(read_all(store, 64, &pages) == expected);
+    REQUIRE(pages > 10);
+    REQUIRE(read_all(store, 4096, &pages) == expected);
+    REQUIRE(pages == 1);
+
+    // a cursor past the last id reads nothing and stays where it is
+    std::vector<char> buf(256);
+    int cnt = -1;
+    REQUIRE(store.read_batch(200, buf.data(), (int)buf.size()) == 200);
+    memcpy(&cnt, buf.data(), sizeof(cnt));
+    REQUIRE(cnt == 0);
+
+    // a buffer too small for any entry reads nothing
+    REQUIRE(store.read_batch(0, buf.data(), RECORD_ENTRY_ALIGN - 1) == 0);
+}
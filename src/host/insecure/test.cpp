@@ -74,5 +74,6 @@ TEST_CASE("Face Recognition", "Integration test")
     verify("biden1.jpg", 2);
     verify("biden2.jpg", 2);
 
+    z_shutdown_enclave();
     destroy_distributed_tee_context(ctx);
 }
@@ -17,8 +17,8 @@ extern "C" {
 #endif
 
 extern cc_enclave_t *g_enclave_context;
-extern void z_create_enclave(const char*, bool is_proxy);
-extern void z_destroy_enclave();
+extern void z_acquire_enclave(const char*, bool is_proxy);
+extern void z_release_enclave();
 
 #ifdef __cplusplus
 }
@@ -27,7 +27,7 @@ extern void z_destroy_enclave();
 int img_recorder(char* arr, int id) {
   int retval;
 
-  z_create_enclave("enclave.signed.so", false);
+  z_acquire_enclave("enclave.signed.so", false);
 
   cc_enclave_result_t __Z_res = __secure_img_recorder_impl(g_enclave_context, &retval , arr, id);
   if (__Z_res != CC_SUCCESS) {
@@ -35,14 +35,14 @@ int img_recorder(char* arr, int id) {
     exit(-1);
   } 
 
-  z_destroy_enclave();
+  z_release_enclave();
 
   return retval;
 }
 int img_verifier(char* arr) {
   int retval;
 
-  z_create_enclave("enclave.signed.so", false);
+  z_acquire_enclave("enclave.signed.so", false);
 
   cc_enclave_result_t __Z_res = __secure_img_verifier_impl(g_enclave_context, &retval , arr);
   if (__Z_res != CC_SUCCESS) {
@@ -50,8 +50,37 @@ int img_verifier(char* arr) {
     exit(-1);
   } 
 
-  z_destroy_enclave();
+  z_release_enclave();
 
   return retval;
 }
+int img_recorder_batch(char* imgs, int imgs_len, char* ids, int ids_len, char* status, int status_len) {
+  int retval;
+
+  z_acquire_enclave("enclave.signed.so", false);
 
+  cc_enclave_result_t __Z_res = __secure_img_recorder_batch_impl(g_enclave_context, &retval , imgs, imgs_len, ids, ids_len, status, status_len);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  } 
+
+  z_release_enclave();
+
+  return retval;
+}
+int pq_train(int iters) {
+  int retval;
+
+  z_acquire_enclave("enclave.signed.so", false);
+
+  cc_enclave_result_t __Z_res = __secure_pq_train_impl(g_enclave_context, &retval , iters);
+  if (__Z_res != CC_SUCCESS) {
+    printf("Ecall enclave error\n");
+    exit(-1);
+  } 
+
+  z_release_enclave();
+
+  return retval;
+}
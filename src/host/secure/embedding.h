@@ -3,11 +3,23 @@
 #define HEIGHT WIDTH
 #define IMG_SIZE 1 * WIDTH *HEIGHT * 3
 #define EMB_LEN 128
-#define EMBEDDING_SIZE 1 * EMB_LEN * sizeof(float) + 200
+#define EMBEDDING_SIZE (1 * EMB_LEN * sizeof(float) + 200)
+// faces per img_recorder_batch call, bounded by the untrusted shared memory
+#define MAX_BATCH_CNT 8
 typedef char in_char;
 typedef char out_char;
 int img_recorder(in_char arr[IMG_SIZE], int id);
 int img_verifier(in_char arr[IMG_SIZE]);
+// imgs: cnt * IMG_SIZE bytes, ids: cnt ints, status: cnt ints receiving the
+// sealed length of each record or -1. returns the number of recorded faces.
+int img_recorder_batch(in_char *imgs, int imgs_len, in_char *ids, int ids_len,
+                       out_char *status, int status_len);
+// train the product quantizer of the gallery on the enrolled faces with iters
+// k-means rounds and seal its codebook. returns the number of training faces.
+int pq_train(int iters);
+// the enclave stays loaded between the calls above. destroy it before
+// destroy_distributed_tee_context, otherwise it goes at exit
+extern "C" void z_shutdown_enclave();
 // int embedding(in_char img[IMG_SIZE], out_char res[EMBEDDING_SIZE]);
 
 // // int calculate_distance(in_char emb1[EMBEDDING_SIZE],
@@ -11,8 +11,26 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
 #include "distributed_face_recognition_u.h"
 #include "enclave.h"
+// a loaded enclave is kept between ecalls and destroyed once it has been
+// idle this long, or by z_shutdown_enclave
+#define ENCLAVE_IDLE_TIMEOUT_SEC 60
+// enclaves a compute node keeps for remote ecalls, 0 for one per hart. every
+// instance loads its own model and gallery cache into secure memory. the
+// instances of one enclave file share its gallery only through the files
+#define ENCLAVE_POOL_SIZE 2
+// seconds a verified report is accepted again without checking it, 0 to
+// check every report
+#define ATTESTATION_CACHE_SEC 300
 #define PRIVATE_KEY_SIZE 32
 #define PUBLIC_KEY_SIZE 64
 #define HASH_SIZE 32
@@ -183,6 +201,12 @@ using cc_ecall_enclave_func_t = std::remove_const_t<decltype(std::declval<cc_enc
 extern "C"
 {
     static cc_ecall_enclave_func_t cc_ecall_enclave;
+    // the padded copies of the marshalled arguments local_tee_ecall_enclave
+    // hands to the sdk. they are kept per thread and only grow, so after the
+    // first ecall of a thread no call allocates. ecalls do not nest, the
+    // ocalls never ecall back
+    static thread_local std::vector<char> t_fake_input_buffer;
+    static thread_local std::vector<char> t_fake_output_buffer;
     int local_tee_ecall_enclave(cc_enclave_t *enclave,
                                   uint32_t function_id,
                                   const void *input_buffer,
@@ -194,8 +218,14 @@ extern "C"
     {
         int fake_input_buffer_size = input_buffer_size + 4;
         int fake_output_buffer_size = output_buffer_size + 1;
-        void *fake_input_buffer = malloc(fake_input_buffer_size);
-        void *fake_output_buffer = malloc(fake_output_buffer_size);
+        if ((int)t_fake_input_buffer.size() < fake_input_buffer_size) {
+            t_fake_input_buffer.resize(fake_input_buffer_size);
+        }
+        if ((int)t_fake_output_buffer.size() < fake_output_buffer_size) {
+            t_fake_output_buffer.resize(fake_output_buffer_size);
+        }
+        void *fake_input_buffer = t_fake_input_buffer.data();
+        void *fake_output_buffer = t_fake_output_buffer.data();
 
         memcpy(fake_input_buffer, input_buffer, input_buffer_size);
         memcpy(fake_output_buffer, output_buffer, output_buffer_size);
@@ -209,8 +239,6 @@ extern "C"
         int res = cc_ecall_enclave(enclave, function_id, fake_input_buffer, fake_input_buffer_size, fake_output_buffer, fake_output_buffer_size, ms, ocall_table);
 
         memcpy(output_buffer, fake_output_buffer, output_buffer_size);
-        free(fake_input_buffer);
-        free(fake_output_buffer);
 
         return res;
     }
@@ -462,6 +490,139 @@ extern "C"
         return res;
     }
 
+    // attestation cache. the measurement an enclave file should have is read
+    // from its .note.penglaimeta once per version of the file, and a report
+    // that passed is_report_valid is accepted again for ATTESTATION_CACHE_SEC
+    // without the SM2 checks. both are dropped when the file changes
+    struct EnclaveFileId
+    {
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+    };
+
+    struct ExpectedHash
+    {
+        EnclaveFileId file;
+        unsigned char hash[HASH_SIZE];
+    };
+
+    struct VerifiedReport
+    {
+        EnclaveFileId file;
+        std::chrono::steady_clock::time_point verified_at;
+    };
+
+    static std::mutex g_attest_mutex;
+    static std::map<std::string, ExpectedHash> g_expected_hashes;
+    // keyed by the enclave path followed by the report, the pub key and its
+    // signature
+    static std::map<std::string, VerifiedReport> g_verified_reports;
+
+    static EnclaveFileId enclave_file_id(const struct stat& st)
+    {
+        return {st.st_dev, st.st_ino, st.st_size, st.st_mtim};
+    }
+
+    static bool is_same_file(const EnclaveFileId& a, const EnclaveFileId& b)
+    {
+        return a.dev == b.dev && a.ino == b.ino && a.size == b.size &&
+               a.mtime.tv_sec == b.mtime.tv_sec &&
+               a.mtime.tv_nsec == b.mtime.tv_nsec;
+    }
+
+    // the enclave hash stored in the metadata of enclave_path, before the
+    // nonce of a report is mixed in
+    static bool get_expected_hash(const char* enclave_path,
+                                  const EnclaveFileId& file,
+                                  unsigned char hash[HASH_SIZE])
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_attest_mutex);
+            auto it = g_expected_hashes.find(enclave_path);
+            if (it != g_expected_hashes.end() &&
+                is_same_file(it->second.file, file)) {
+                memcpy(hash, it->second.hash, HASH_SIZE);
+                return true;
+            }
+        }
+
+        int fd = open(enclave_path, O_RDONLY);
+        if (fd < 0) {
+            printf("open enclave file failed\n");
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            printf("enclave file size is 0\n");
+            close(fd);
+            return false;
+        }
+
+        void* elf_ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (elf_ptr == MAP_FAILED) {
+            printf("mmap enclave file failed\n");
+            return false;
+        }
+        unsigned long meta_offset, meta_size;
+        bool found = get_meta_property((unsigned char*)elf_ptr, st.st_size,
+                                       &meta_offset, &meta_size) != -1;
+        if (found) {
+            memcpy(hash, (char*)elf_ptr + meta_offset, HASH_SIZE);
+        }
+        munmap(elf_ptr, st.st_size);
+        if (!found) {
+            return false;
+        }
+
+        // keyed by what was read, a file replaced meanwhile misses next time
+        ExpectedHash expected;
+        expected.file = enclave_file_id(st);
+        memcpy(expected.hash, hash, HASH_SIZE);
+        std::lock_guard<std::mutex> lock(g_attest_mutex);
+        g_expected_hashes[enclave_path] = expected;
+        return true;
+    }
+
+    static bool is_report_cached(const std::string& key,
+                                 const EnclaveFileId& file)
+    {
+        std::lock_guard<std::mutex> lock(g_attest_mutex);
+        auto it = g_verified_reports.find(key);
+        if (it == g_verified_reports.end()) {
+            return false;
+        }
+        auto age = std::chrono::steady_clock::now() - it->second.verified_at;
+        if (!is_same_file(it->second.file, file) ||
+            age >= std::chrono::seconds(ATTESTATION_CACHE_SEC)) {
+            g_verified_reports.erase(it);
+            return false;
+        }
+        return true;
+    }
+
+    static void cache_report(const std::string& key, const EnclaveFileId& file)
+    {
+        if (ATTESTATION_CACHE_SEC <= 0) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(g_attest_mutex);
+        for (auto it = g_verified_reports.begin();
+             it != g_verified_reports.end();) {
+            if (now - it->second.verified_at >=
+                std::chrono::seconds(ATTESTATION_CACHE_SEC)) {
+                it = g_verified_reports.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        g_verified_reports[key] = {file, now};
+    }
+
     bool is_report_valid(const void *report_p,
                                  const void *pub_key,
                                  const void *pub_key_signature,
@@ -469,6 +630,22 @@ extern "C"
     {
         struct report_t* report = (struct report_t*)report_p;
 
+        struct stat enclave_stat;
+        if (stat(enclave_path, &enclave_stat) != 0) {
+            printf("open enclave file failed\n");
+            return false;
+        }
+        EnclaveFileId file = enclave_file_id(enclave_stat);
+        std::string cache_key(enclave_path);
+        cache_key.push_back('\0');
+        cache_key.append((const char*)report, sizeof(struct report_t));
+        cache_key.append((const char*)pub_key, PUBLIC_KEY_SIZE);
+        cache_key.append((const char*)pub_key_signature,
+                         sizeof(struct signature_t));
+        if (is_report_cached(cache_key, file)) {
+            return true;
+        }
+
         // 0. check the pub_key signature
         {
             struct pubkey_t* sm_pub_key =
@@ -509,46 +686,25 @@ print_str(sizeof(*report), "report", report);
 
         // 2. check the hash
         {
-            bool is_valid = true;
-            int fd = open(enclave_path, O_RDONLY);
-            if (fd < 0) {
-                printf("open enclave file failed\n");
-                return false;
-            }
-            struct stat stat;
-            fstat(fd, &stat);
-            if (stat.st_size == 0) {
-                printf("enclave file size is 0\n");
-                return false;
-            }
-
             // calculate the correct hash
-            void* elf_ptr = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-            unsigned long meta_offset, meta_size;
-            if (-1 == get_meta_property((unsigned char*)elf_ptr, stat.st_size,
-                                        &meta_offset, &meta_size)) {
-                exit(-1);
+            unsigned char elf_hash[HASH_SIZE];
+            if (!get_expected_hash(enclave_path, file, elf_hash)) {
+                return false;
             }
-            char* elf_hash = (char*)malloc(HASH_SIZE);
-            memcpy(elf_hash, (char*)elf_ptr + meta_offset, HASH_SIZE);
             update_enclave_hash(elf_hash, report->enclave.nonce);
 
             // compare with the received hash
             printf("expected hash:\n");
-            printHex((unsigned char*)elf_hash, HASH_SIZE);
+            printHex(elf_hash, HASH_SIZE);
             printf("calculated hash:\n");
             printHex((unsigned char*)report->enclave.hash, HASH_SIZE);
-            if (!is_same_bytes(elf_hash, (char*)report->enclave.hash,
+            if (!is_same_bytes((char*)elf_hash, (char*)report->enclave.hash,
                                HASH_SIZE)) {
-                is_valid = false;
-            }
-            close(fd);
-            free(elf_hash);
-            if (!is_valid) {
                 return false;
             }
         }
 
+        cache_report(cache_key, file);
         return true;
     }
 
@@ -615,26 +771,263 @@ print_str(sizeof(*report), "report", report);
         exit(-1);
     }
 
-    void z_destroy_enclave()
+    // lifecycle of g_enclave: it is created by the first z_acquire_enclave
+    // and reused by all later ones, instead of paying cc_enclave_create for
+    // every ecall. all of the state below is guarded by g_enclave_mutex
+    static std::mutex g_enclave_mutex;
+    static std::condition_variable g_enclave_cv;
+    // path of the enclave loaded in g_enclave, empty if none is
+    static std::string g_loaded_enclave_path;
+    // callers between z_acquire_enclave and z_release_enclave
+    static int g_enclave_users = 0;
+    // set while one caller creates the enclave outside of the lock
+    static bool g_enclave_loading = false;
+    static std::chrono::steady_clock::time_point g_enclave_last_use;
+    // destroys the enclave after ENCLAVE_IDLE_TIMEOUT_SEC without users
+    static std::thread g_enclave_reaper;
+    static bool g_enclave_reaper_stop = false;
+
+    static void z_destroy_enclave()
     {
-        if (is_migrate()) {
+        if (g_loaded_enclave_path.empty()) {
             return;
         }
+        cc_enclave_result_t res = cc_enclave_destroy(&g_enclave);
+        if (res != CC_SUCCESS) {
+            printf("Destroy enclave error\n");
+        }
+        g_loaded_enclave_path.clear();
         if (g_enclave_context == &g_enclave) {
-            cc_enclave_result_t res = cc_enclave_destroy(g_enclave_context);
+            g_enclave_context = NULL;
+        }
+    }
+
+    static void reap_idle_enclave()
+    {
+        std::unique_lock<std::mutex> lock(g_enclave_mutex);
+        while (!g_enclave_reaper_stop) {
+            if (g_loaded_enclave_path.empty() || g_enclave_users > 0) {
+                g_enclave_cv.wait(lock);
+                continue;
+            }
+            auto deadline = g_enclave_last_use +
+                            std::chrono::seconds(ENCLAVE_IDLE_TIMEOUT_SEC);
+            if (std::chrono::steady_clock::now() >= deadline) {
+                z_destroy_enclave();
+                continue;
+            }
+            g_enclave_cv.wait_until(lock, deadline);
+        }
+    }
+
+    // make g_enclave_context usable for ecalls into enclave_path, loading it
+    // only if it is not loaded yet. must be paired with z_release_enclave
+    void z_acquire_enclave(const char* enclave_path, bool is_proxy = false)
+    {
+        if (g_forced_enclave_path) enclave_path = g_forced_enclave_path;
+        std::unique_lock<std::mutex> lock(g_enclave_mutex);
+        if (is_migrate() || is_transparent() && !exist_local_tee()) {
+            g_enclave_context = &hook_enclave;
+            g_enclave_users++;
+            return;
+        }
+
+        // every wait may end with another caller having loaded enclave_path
+        // meanwhile, so the loaded path is checked again after each of them
+        for (;;) {
+            g_enclave_cv.wait(lock, [] { return !g_enclave_loading; });
+            if (g_loaded_enclave_path == enclave_path) {
+                break;
+            }
+            // only one enclave is kept, another one replaces it once unused
+            g_enclave_cv.wait(lock, [] {
+                return g_enclave_users == 0 && !g_enclave_loading;
+            });
+            if (g_loaded_enclave_path == enclave_path) {
+                break;
+            }
+            z_destroy_enclave();
+
+            // creating takes long and exits on failure, so it runs unlocked
+            g_enclave_loading = true;
+            lock.unlock();
+            z_create_enclave(enclave_path, is_proxy);
+            lock.lock();
+            g_enclave_loading = false;
+            g_loaded_enclave_path = enclave_path;
+            g_enclave_last_use = std::chrono::steady_clock::now();
+            g_enclave_cv.notify_all();
+            if (!g_enclave_reaper.joinable()) {
+                g_enclave_reaper_stop = false;
+                g_enclave_reaper = std::thread(reap_idle_enclave);
+            }
+        }
+        g_enclave_context = &g_enclave;
+        g_enclave_users++;
+    }
+
+    void z_release_enclave()
+    {
+        std::lock_guard<std::mutex> lock(g_enclave_mutex);
+        g_enclave_users--;
+        g_enclave_last_use = std::chrono::steady_clock::now();
+        g_enclave_cv.notify_all();
+    }
+
+    // pool of enclaves serving ecall_proxy, so that a compute node runs one
+    // remote ecall per hart instead of all of them in g_enclave. instances
+    // are created on demand for each enclave file and kept. once the pool is
+    // full, the least recently used idle instance of another file is
+    // replaced. callers wait for an instance in arrival order. ecalls that
+    // write the gallery always take the first instance of their file, so
+    // that two of them never run in different instances at once
+    struct PooledEnclave
+    {
+        cc_enclave_t enclave{};
+        // enclave file loaded in the instance, empty if none is
+        std::string path;
+        bool busy = false;
+        std::chrono::steady_clock::time_point last_use;
+    };
+
+    static std::mutex g_pool_mutex;
+    static std::condition_variable g_pool_cv;
+    static std::vector<std::unique_ptr<PooledEnclave>> g_pool;
+    // tickets of the dispatch queue, the caller holding g_pool_serving is
+    // the next to get an instance
+    static uint64_t g_pool_next_ticket = 0;
+    static uint64_t g_pool_serving = 0;
+
+    static bool is_gallery_writer(uint32_t fid)
+    {
+        return fid == fid___secure_img_recorder_impl ||
+               fid == fid___secure_img_recorder_batch_impl ||
+               fid == fid___secure_pq_train_impl;
+    }
+
+    static int pool_capacity()
+    {
+        if (ENCLAVE_POOL_SIZE > 0) {
+            return ENCLAVE_POOL_SIZE;
+        }
+        long harts = sysconf(_SC_NPROCESSORS_ONLN);
+        return harts > 0 ? (int)harts : 1;
+    }
+
+    // an instance for enclave_path, or NULL if the caller has to wait. sets
+    // *load when the instance has to be (re)loaded first
+    static PooledEnclave* pick_pooled_enclave(const std::string& enclave_path,
+                                              bool writer, bool* load)
+    {
+        PooledEnclave* lru = NULL;
+        bool loaded = false;
+        for (auto& inst : g_pool) {
+            if (inst->path == enclave_path) {
+                if (!inst->busy) {
+                    *load = false;
+                    return inst.get();
+                }
+                if (writer) {
+                    return NULL;
+                }
+                loaded = true;
+            }
+            else if (!inst->busy && (!lru || inst->last_use < lru->last_use)) {
+                lru = inst.get();
+            }
+        }
+        *load = true;
+        if ((int)g_pool.size() < pool_capacity()) {
+            g_pool.emplace_back(new PooledEnclave);
+            return g_pool.back().get();
+        }
+        // only evict for a file that has no instance at all, otherwise two
+        // versions would keep replacing each other
+        return loaded ? NULL : lru;
+    }
+
+    static PooledEnclave* checkout_pooled_enclave(const char* enclave_path,
+                                                  bool writer)
+    {
+        if (g_forced_enclave_path) enclave_path = g_forced_enclave_path;
+        std::unique_lock<std::mutex> lock(g_pool_mutex);
+        const uint64_t ticket = g_pool_next_ticket++;
+        PooledEnclave* inst = NULL;
+        bool load = false;
+        g_pool_cv.wait(lock, [&] {
+            if (ticket != g_pool_serving) {
+                return false;
+            }
+            inst = pick_pooled_enclave(enclave_path, writer, &load);
+            return inst != NULL;
+        });
+        g_pool_serving++;
+        inst->busy = true;
+        std::string evicted = inst->path;
+        inst->path = enclave_path;
+        g_pool_cv.notify_all();
+        lock.unlock();
+
+        if (load) {
+            // the instance is ours while busy, loading runs unlocked so
+            // that the other instances keep serving
+            if (!evicted.empty()) {
+                cc_enclave_destroy(&inst->enclave);
+            }
+            cc_enclave_result_t res =
+                cc_enclave_create(enclave_path, AUTO_ENCLAVE_TYPE, 0,
+                                  SECGEAR_DEBUG_FLAG, NULL, 0, &inst->enclave);
             if (res != CC_SUCCESS) {
-                printf("Destroy enclave error\n");
+                printf("Create enclave error\n");
+                exit(-1);
             }
-            g_enclave_context = NULL;
+        }
+        return inst;
+    }
+
+    static void release_pooled_enclave(PooledEnclave* inst)
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        inst->busy = false;
+        inst->last_use = std::chrono::steady_clock::now();
+        g_pool_cv.notify_all();
+    }
+
+    // destroy the enclave kept loaded, called before the distributed tee
+    // context goes away and at exit. an enclave still in an ecall, as when
+    // exit() is called from an ocall, is left to the process teardown
+    void z_shutdown_enclave()
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_pool_mutex);
+            for (auto& inst : g_pool) {
+                if (!inst->busy && !inst->path.empty()) {
+                    cc_enclave_destroy(&inst->enclave);
+                    inst->path.clear();
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(g_enclave_mutex);
+            g_enclave_reaper_stop = true;
+            g_enclave_cv.notify_all();
+        }
+        if (g_enclave_reaper.joinable()) {
+            g_enclave_reaper.join();
+        }
+        std::lock_guard<std::mutex> lock(g_enclave_mutex);
+        if (g_enclave_users == 0) {
+            z_destroy_enclave();
         }
     }
 
     std::vector<char> get_report(const char* enclave_path)
     {
-        z_create_enclave(enclave_path);
+        z_acquire_enclave(enclave_path);
         std::vector<char> report(sizeof(struct report_t));
         memcpy(report.data(), &current_report, sizeof(struct report_t));
-        z_destroy_enclave();
+        z_release_enclave();
         return report;
     }
 
@@ -656,7 +1049,7 @@ print_str(sizeof(*report), "report", report);
     {
         int retval;
 
-        z_create_enclave("enclave.signed.so");
+        z_acquire_enclave("enclave.signed.so");
 
         cc_enclave_result_t __Z_res =
             __secure_key_exchange_impl(g_enclave_context, &retval, in_key,
@@ -668,7 +1061,7 @@ print_str(sizeof(*report), "report", report);
             exit(-1);
         }
 
-        z_destroy_enclave();
+        z_release_enclave();
 
         return retval;
     }
@@ -696,16 +1089,13 @@ print_str(sizeof(*report), "report", report);
     int ecall_proxy(const char* enclave_filename, uint32_t fid, char* in_buf,
                     int in_buf_size, char* out_buf, int out_buf_size)
     {
-        z_create_enclave(enclave_filename, true);
+        PooledEnclave* inst =
+            checkout_pooled_enclave(enclave_filename, is_gallery_writer(fid));
         cc_enclave_result_t ret = CC_FAIL;
         uint32_t ms = 0;
 
         /* Call the cc_enclave function */
-        cc_enclave_t* enclave = g_enclave_context;
-        if (!enclave) {
-            ret = CC_ERROR_BAD_PARAMETERS;
-            goto exit;
-        }
+        cc_enclave_t* enclave = &inst->enclave;
         if (pthread_rwlock_rdlock(&enclave->rwlock)) {
             ret = CC_ERROR_BUSY;
             goto exit;
@@ -730,7 +1120,7 @@ print_str(sizeof(*report), "report", report);
         ret = CC_SUCCESS;
 
     exit:
-        z_destroy_enclave();
+        release_pooled_enclave(inst);
         return ret;
     }
 }
@@ -756,4 +1146,7 @@ struct DteeEnvInit {
         // // z_create_enclave();
 
     }
+    ~DteeEnvInit() {
+        z_shutdown_enclave();
+    }
 } env_init;